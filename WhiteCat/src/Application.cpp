@@ -19,21 +19,18 @@ std::atomic<int> Application::dataFlag(0);
 
 Application::Application()
 {
-	common = static_cast<WC_Data*>(malloc(sizeof(WC_Data)));
-	mutex = new std::mutex();
+	common = new WC_Data();
+	graphicsThread = nullptr;
+	physicsThread = nullptr;
 }
 
 
 Application::~Application()
 {
-	if (common->pos_data != nullptr)
-		free(common->pos_data);
-	if(common != nullptr)
-		free(common);
+	delete common;
 
 	delete graphicsThread;
 	delete  physicsThread;
-	delete mutex;
 }
 
 void Application::setup(Ftype type, GeneralFunc function)
@@ -46,8 +43,8 @@ void Application::startThread(Ttype type)
 	// Only one isntance of gThread and pThread should run
 	if (type == WC_GTHREAD && gtStarted || type == WC_PTHREAD && ptStarted) return;
 
-	SWITCH_T(graphicsThread = new std::thread(std::move(graphicsFunc), mutex, common); gtStarted = true,
-		physicsThread = new std::thread(std::move(physicsFunc), mutex, common); ptStarted = true);
+	SWITCH_T(graphicsThread = new std::thread(std::move(graphicsFunc), common); gtStarted = true,
+		physicsThread = new std::thread(std::move(physicsFunc), common); ptStarted = true);
 }
 
 void Application::joinThread(Ttype type)
@@ -1,7 +1,6 @@
 #pragma once
 #include "utils.h"
 #include <thread>
-#include <mutex>
 #include <functional>
 #include <atomic>
 
@@ -14,7 +13,8 @@
 typedef unsigned int Ftype;
 typedef unsigned int Ttype;
 
-typedef std::function<void(std::mutex*, WC_Data*)> GeneralFunc;
+//Both threads only share the WC_Data, its frame hand-off is lock free
+typedef std::function<void(WC_Data*)> GeneralFunc;
 
 class Application
 {
@@ -34,7 +34,6 @@ public:
 private:
 	std::thread* graphicsThread;
 	std::thread*  physicsThread;
-	std::mutex* mutex;
 
 	GeneralFunc graphicsFunc;
 	GeneralFunc  physicsFunc;
@@ -2,11 +2,42 @@
 #include <iostream>
 #include <string>
 #include <stack>
+#include <vector>
 #include <algorithm>
 #include <regex>
+#include <cmath>
+#include <cstdlib>
+#include <complex>
+#include <stdexcept>
+
+#include <assert.h>
 
 typedef unsigned int uint;
 
+//Per type constants the parser needs - the imaginary unit only exists for complex types
+template<typename T>
+struct EvaluatorTraits
+{
+	static const bool hasImaginaryUnit = false;
+
+	//Never reached: compile rejects 'i' for these types before emitting anything
+	static T imaginaryUnit()
+	{
+		return T(0);
+	}
+};
+
+template<typename T>
+struct EvaluatorTraits<std::complex<T>>
+{
+	static const bool hasImaginaryUnit = true;
+
+	static std::complex<T> imaginaryUnit()
+	{
+		return std::complex<T>(T(0), T(1));
+	}
+};
+
 template<typename I, typename O>
 class Evaluator
 {
@@ -14,19 +45,24 @@ public:
 	Evaluator() = default;
 	~Evaluator() = default;
 
-	Evaluator operator=(std::string expression) noexcept
+	/* Throws std::invalid_argument if the expression cannot be compiled for this type (the imaginary
+	 * unit in a real valued evaluator), the evaluator then keeps its previous expression.
+	 */
+	Evaluator& operator=(std::string expression)
 	{
-		this->expression = expression;
-
 		//Replace verbal operators for characters
 		std::regex patternS("Sin");
-		this->expression = std::regex_replace(this->expression, patternS, "S");
+		expression = std::regex_replace(expression, patternS, "S");
 
 		std::regex patternE("Exp");
-		this->expression = std::regex_replace(this->expression, patternE, "E");
+		expression = std::regex_replace(expression, patternE, "E");
 
 		std::regex patternL("Log");
-		this->expression = std::regex_replace(this->expression, patternL, "L");
+		expression = std::regex_replace(expression, patternL, "L");
+
+		//Parse only once, every later call just runs the program
+		compile(expression);
+		this->expression = expression;
 
 		return *this;
 	}
@@ -44,22 +80,155 @@ public:
 		return calcExpr(x, y, z);
 	}
 
+	/* INPUT: xs (ys, zs) - n sample coordinates; n - number of samples
+	 * OUTPUT: out - n results, evaluated block by block so every operator runs as a flat loop
+	 */
+	void evaluate(const I* xs, O* out, size_t n)
+	{
+		runBlocks(xs, nullptr, nullptr, out, n);
+	}
+	void evaluate(const I* xs, const I* ys, O* out, size_t n)
+	{
+		runBlocks(xs, ys, nullptr, out, n);
+	}
+	void evaluate(const I* xs, const I* ys, const I* zs, O* out, size_t n)
+	{
+		runBlocks(xs, ys, zs, out, n);
+	}
+
+	//Sets the value of the time variable t used by every later evaluation
+	void setTime(I t)
+	{
+		tVal = t;
+	}
+
+	/* INPUT: xs - n grid points U(x, t) will be sampled on
+	 * Every subexpression that only depends on x is sampled here once and cached.
+	 * Throws std::invalid_argument if the expression uses y or z. compile() unbinds the grid.
+	 */
+	void bindGrid(const I* xs, size_t n);
+
+	/* INPUT: t - time
+	 * OUTPUT: out - U(x, t) at the bound grid points (n values)
+	 * Only the t dependent part of the program is recomputed, x only terms come from the cache.
+	 */
+	void evaluateAt(I t, O* out);
+
+	//Selects the variable ('x', 'y', 'z' or 't') the derivative entry points differentiate against
+	void differentiate(char var)
+	{
+		dVar = (var == 'y') ? OpCode::PushY : (var == 'z') ? OpCode::PushZ : (var == 't') ? OpCode::PushT : OpCode::PushX;
+		buildDerivative();
+	}
+
+	/* INPUT: x (y, z) - sample point
+	 * OUTPUT: Returns the derivative at that point; value - if not null receives the expression value
+	 * Value and derivative come out of the same forward mode pass over the program.
+	 */
+	O derivative(I x, O* value = nullptr)
+	{
+		O d;
+		runDualBlocks(&x, nullptr, nullptr, value, &d, 1);
+		return d;
+	}
+	O derivative(I x, I y, O* value = nullptr)
+	{
+		O d;
+		runDualBlocks(&x, &y, nullptr, value, &d, 1);
+		return d;
+	}
+	O derivative(I x, I y, I z, O* value = nullptr)
+	{
+		O d;
+		runDualBlocks(&x, &y, &z, value, &d, 1);
+		return d;
+	}
+
+	/* INPUT: xs (ys, zs) - n sample coordinates; n - number of samples
+	 * OUTPUT: out - n values (may be nullptr); dout - n derivatives, both from a single fused pass
+	 */
+	void evaluateDerivative(const I* xs, O* out, O* dout, size_t n)
+	{
+		runDualBlocks(xs, nullptr, nullptr, out, dout, n);
+	}
+	void evaluateDerivative(const I* xs, const I* ys, O* out, O* dout, size_t n)
+	{
+		runDualBlocks(xs, ys, nullptr, out, dout, n);
+	}
+	void evaluateDerivative(const I* xs, const I* ys, const I* zs, O* out, O* dout, size_t n)
+	{
+		runDualBlocks(xs, ys, zs, out, dout, n);
+	}
 
 private:
 
+	//Postfix bytecode - operands are pushed, operators pop theirs and push the result
+	enum class OpCode : unsigned char
+	{
+		PushConst,
+		PushX,
+		PushY,
+		PushZ,
+		PushT,
+		PushCached, //Grid cached subexpression, index selects the cache row
+		PushUniform, //Per step scalar subexpression, index selects the value
+		Add,
+		Sub,
+		Mul,
+		Div,
+		Pow,
+		Neg,
+		Sqr,
+		Cube,
+		Sin,
+		Exp,
+		Log
+	};
+
+	struct Instruction
+	{
+		OpCode code;
+		I value;
+		uint index;
+	};
+
+	//Dependency of a subexpression on the grid variables and on time
+	enum : unsigned char
+	{
+		DEPENDS_GRID = 1,
+		DEPENDS_TIME = 2
+	};
+
 	std::string expression;
+	std::vector<Instruction> program;
+	std::vector<I> valueStack; //Sized at compile time, reused by every run
+	std::vector<I> blockStack; //Same as above but BLOCK lanes wide, used by the batch entry points
+
+	//Samples processed per operator in the batch path (fits L1 for the usual stack depths)
+	static const size_t BLOCK = 256;
+
+	//Derivative program: per instruction, which operands carry a non zero tangent
+	enum : unsigned char
+	{
+		ACTIVE_LEFT = 1, //Also used for the single operand of unary ops
+		ACTIVE_RIGHT = 2
+	};
+	std::vector<unsigned char> activity;
+	std::vector<I> dBlockStack; //Tangents, laid out as blockStack
+	OpCode dVar = OpCode::PushX;
+	bool resultActive = false;
 
 	O calcExpr(I var)
 	{
 		xVal = var;
-		return evaluateExpr(expression);
+		return O(runProgram(program));
 	}
 
 	O calcExpr(I var1, I var2)
 	{
 		xVal = var1;
 		yVal = var2;
-		return evaluateExpr(expression);
+		return O(runProgram(program));
 	}
 
 	O calcExpr(I var1, I var2, I var3)
@@ -67,19 +236,46 @@ private:
 		xVal = var1;
 		yVal = var2;
 		zVal = var3;
-		return evaluateExpr(expression);
+		return O(runProgram(program));
 	}
 
-	O evaluateExpr(std::string expr);
-	void processCP(std::stack<I>& vStack, std::stack<char>& cStack);
-	I processIV(std::string expr, uint pos, std::stack<I>& vStack);
-	void processIO(char op, std::stack<I>& vStack, std::stack<char>& cStack);
+	void compile(const std::string& expr);
+	void processCP(std::stack<char>& cStack);
+	uint processIV(const std::string& expr, uint pos);
+	void processIO(char op, std::stack<char>& cStack);
 	bool opCausesEV(char op, char prevOp);
-	void executeOP(std::stack<I>& vStack, std::stack<char>& cStack);
+	void executeOP(std::stack<char>& cStack);
+	void emit(OpCode code, I value = I(0));
+	void optimize();
+	static bool isBinary(OpCode code);
+	static I applyOP(OpCode code, I left, I right);
+	void splitTime(const std::vector<size_t>& starts, const std::vector<unsigned char>& deps, size_t end);
+	static bool isPush(OpCode code);
+	I runProgram(const std::vector<Instruction>& prog);
+	void runBlocks(const I* xs, const I* ys, const I* zs, O* out, size_t n)
+	{
+		runBlocks(program, xs, ys, zs, out, n);
+	}
+	template<typename T>
+	void runBlocks(const std::vector<Instruction>& prog, const I* xs, const I* ys, const I* zs, T* out, size_t n);
+	void buildDerivative();
+	void runDualBlocks(const I* xs, const I* ys, const I* zs, O* out, O* dout, size_t n);
 
 	I xVal = I(0);
 	I yVal = I(0);
 	I zVal = I(0);
+	I tVal = I(0);
+
+	//Incremental U(x, t) state, see bindGrid
+	std::vector<Instruction> timeProgram;
+	std::vector<std::vector<Instruction>> uniformPrograms;
+	std::vector<std::vector<Instruction>> gridPrograms;
+	std::vector<I> uniformValues;
+	std::vector<I> gridCache; //gridPrograms.size() rows of gridSize samples
+	size_t gridSize = 0;
+
+	uint depth = 0;
+	uint maxDepth = 0;
 
 };
 
@@ -87,109 +283,131 @@ private:
 	Point* sPDE(uint step);*/
 
 template<typename I, typename O>
-O Evaluator<I, O>::evaluateExpr(std::string expr)
+void Evaluator<I, O>::compile(const std::string& expr)
 {
-	std::stack<I> valueStack;
+	//Checked before anything is cleared, so a rejected expression leaves the old program intact
+	if (!EvaluatorTraits<I>::hasImaginaryUnit && expr.find('i') != std::string::npos)
+	{
+		throw std::invalid_argument("Imaginary unit 'i' in the expression of a real valued Evaluator: " + expr);
+	}
+
 	std::stack<char> operatorStack;
 
+	program.clear();
+
+	//The grid split belongs to the old program: the new one is unbound until the next bindGrid
+	timeProgram.clear();
+	uniformPrograms.clear();
+	gridPrograms.clear();
+	uniformValues.clear();
+	gridCache.clear();
+	gridSize = 0;
+	depth = 0;
+	maxDepth = 0;
+
 	//Push a left bracket so the evaluation always finishes
 	operatorStack.push('(');
 
+	//A '-' or '+' found where an operand is expected is a sign, not a binary operator
+	bool expectOperand = true;
+
 	uint pos = 0;
 	while (pos <= expr.size())
 	{
-		if (expr[pos] == ' ') //Get rid of blank spaces
+		if (pos < expr.size() && expr[pos] == ' ') //Get rid of blank spaces
 		{
 			pos++;
 		}
 		else if (pos == expr.size() || expr[pos] == ')') //Check if end or bracket close
 		{
-			processCP(valueStack, operatorStack);
+			processCP(operatorStack);
+			expectOperand = false;
 			pos++;
 		}
 		else if (expr[pos] >= '0' && expr[pos] <= '9' || expr[pos] == '.'
-			|| expr[pos] == 'x' || expr[pos] == 'y' || expr[pos] == 'z') //Check if reading a number
+			|| expr[pos] == 'x' || expr[pos] == 'y' || expr[pos] == 'z' || expr[pos] == 't' || expr[pos] == 'i') //Check if reading a number
+		{
+			pos = processIV(expr, pos);
+			expectOperand = false;
+		}
+		else if (expectOperand && (expr[pos] == '-' || expr[pos] == '+')) //Unary sign
 		{
-			pos = processIV(expr, pos, valueStack);
+			if (expr[pos] == '-')
+				processIO('N', operatorStack);
+			pos++;
 		}
 		else //Else we have an operator present
 		{
-			processIO(expr[pos], valueStack, operatorStack);
+			processIO(expr[pos], operatorStack);
+			expectOperand = true;
 			pos++;
 		}
 	}
 
-	//There should only be one element back on the stack -- make checks here later
-	I val = valueStack.top();
-	valueStack.pop();
-	return val;
+	//There should only be one element back on the stack
+	assert(depth == 1 || program.empty());
 
+	optimize();
+
+	valueStack.assign(std::max(maxDepth, 1u), I(0));
+	blockStack.assign(std::max(maxDepth, 1u) * BLOCK, I(0));
+
+	buildDerivative();
 }
 
 template<typename I, typename O>
-void Evaluator<I, O>::processCP(std::stack<I>& vStack, std::stack<char>& cStack)
+void Evaluator<I, O>::processCP(std::stack<char>& cStack)
 {
-	while (cStack.top() != '(')
+	while (!cStack.empty() && cStack.top() != '(')
 	{
-		executeOP(vStack, cStack);
+		executeOP(cStack);
 	}
 
-	cStack.pop(); //Remove opening bracket
+	if (!cStack.empty())
+		cStack.pop(); //Remove opening bracket
 }
 
 template<typename I, typename O>
-I Evaluator<I, O>::processIV(std::string expr, uint pos, std::stack<I>& vStack)
+uint Evaluator<I, O>::processIV(const std::string& expr, uint pos)
 {
-	I value = I(0); //Complex numbers wont work here for now ...
-	bool decimal = false;
-	uint count = 0;
-	while (pos < expr.size() && expr[pos] >= '0' && expr[pos] <= '9' || expr[pos] == '.'
-		|| expr[pos] == 'x' || expr[pos] == 'y' || expr[pos] == 'z')
+	switch (expr[pos])
 	{
-		if (expr[pos] == 'x')
-		{
-			value = xVal;
-			pos++;
-			break;
-		}
-		else if (expr[pos] == 'y')
-		{
-			value = yVal;
-			pos++;
-			break;
-		}
-		else if (expr[pos] == 'z')
-		{
-			value = zVal;
-			pos++;
-			break;
-		}
-		else if (expr[pos] == '.')
-		{
-			decimal = true;
-			pos++;
-		}
+	case 'x':
+		emit(OpCode::PushX);
+		return pos + 1;
+	case 'y':
+		emit(OpCode::PushY);
+		return pos + 1;
+	case 'z':
+		emit(OpCode::PushZ);
+		return pos + 1;
+	case 't':
+		emit(OpCode::PushT);
+		return pos + 1;
+	case 'i': //Imaginary unit
+		emit(OpCode::PushConst, EvaluatorTraits<I>::imaginaryUnit());
+		return pos + 1;
+	default:
+		break;
+	}
 
-		if (!decimal)
-		{
-			value = 10 * value + (I)(expr[pos++] - '0');
-		}
-		else
-		{
-			value = value + pow(0.1, ++count) * (I)(expr[pos++] - '0');
-		}
+	//Numeric literal - converted once here and stored in the program as a constant
+	uint end = pos;
+	while (end < expr.size() && (expr[end] >= '0' && expr[end] <= '9' || expr[end] == '.'))
+	{
+		end++;
 	}
 
-	vStack.push(value);
-	return pos;
+	emit(OpCode::PushConst, I(std::strtod(expr.substr(pos, end - pos).c_str(), nullptr)));
+	return end;
 }
 
 template<typename I, typename O>
-void Evaluator<I, O>::processIO(char op, std::stack<I>& vStack, std::stack<char>& cStack)
+void Evaluator<I, O>::processIO(char op, std::stack<char>& cStack)
 {
 	while (cStack.size() > 0 && opCausesEV(op, cStack.top()))
 	{
-		executeOP(vStack, cStack);
+		executeOP(cStack);
 	}
 
 	cStack.push(op);
@@ -214,6 +432,7 @@ bool Evaluator<I, O>::opCausesEV(char op, char prevOp)
 		evaluate = true;
 		break;
 	case '^':
+	case 'N': //Negation (unary minus)
 	case 'S': //Sin
 	case 'E': //Exp
 	case 'L': //Log (Natural)
@@ -223,47 +442,694 @@ bool Evaluator<I, O>::opCausesEV(char op, char prevOp)
 	}
 
 	return evaluate;
-} 
+}
 
 template<typename I, typename O>
-void Evaluator<I, O>::executeOP(std::stack<I>& vStack, std::stack<char>& cStack)
+void Evaluator<I, O>::executeOP(std::stack<char>& cStack)
 {
-	I right_operand = vStack.top(); vStack.pop();
-	I left_operand = I(0);
-	if(!vStack.empty())
-		left_operand = vStack.top();
 	char op = cStack.top(); cStack.pop();
 
-	I result = I(0);
-
 	switch (op)
 	{
 	case '+':
-		result = left_operand + right_operand; vStack.pop();
+		emit(OpCode::Add);
 		break;
 	case '-':
-		result = left_operand - right_operand; vStack.pop();
+		emit(OpCode::Sub);
 		break;
 	case '*':
-		result = left_operand * right_operand; vStack.pop();
+		emit(OpCode::Mul);
 		break;
 	case '/':
-		result = left_operand / right_operand; vStack.pop();
+		emit(OpCode::Div);
 		break;
 	case '^':
-		result = pow(left_operand, right_operand); vStack.pop();
+		emit(OpCode::Pow);
+		break;
+	case 'N': //Negation (unary minus)
+		emit(OpCode::Neg);
 		break;
 	case 'S': //Sin
-		result = sin(right_operand);
+		emit(OpCode::Sin);
 		break;
 	case 'E': //Exp
-		result = exp(right_operand);
+		emit(OpCode::Exp);
 		break;
 	case 'L': //Log (Natural)
-		result = log(right_operand);
+		emit(OpCode::Log);
 		break;
 	}
+}
 
-	vStack.push(result);
+template<typename I, typename O>
+void Evaluator<I, O>::emit(OpCode code, I value)
+{
+	//Keep track of the stack depth the program will need at runtime
+	switch (code)
+	{
+	case OpCode::PushConst:
+	case OpCode::PushX:
+	case OpCode::PushY:
+	case OpCode::PushZ:
+	case OpCode::PushT:
+		depth++;
+		break;
+	case OpCode::Add:
+	case OpCode::Sub:
+	case OpCode::Mul:
+	case OpCode::Div:
+	case OpCode::Pow:
+		assert(depth >= 2);
+		depth--;
+		break;
+	default:
+		assert(depth >= 1);
+		break;
+	}
+
+	maxDepth = std::max(maxDepth, depth);
+	program.push_back({ code, value, 0 });
+}
+
+template<typename I, typename O>
+bool Evaluator<I, O>::isPush(OpCode code)
+{
+	return code == OpCode::PushConst || code == OpCode::PushX || code == OpCode::PushY
+		|| code == OpCode::PushZ || code == OpCode::PushT
+		|| code == OpCode::PushCached || code == OpCode::PushUniform;
 }
 
+template<typename I, typename O>
+bool Evaluator<I, O>::isBinary(OpCode code)
+{
+	return code == OpCode::Add || code == OpCode::Sub || code == OpCode::Mul
+		|| code == OpCode::Div || code == OpCode::Pow;
+}
+
+template<typename I, typename O>
+I Evaluator<I, O>::applyOP(OpCode code, I left, I right)
+{
+	//For unary operators only the right operand is used
+	switch (code)
+	{
+	case OpCode::Add:
+		return left + right;
+	case OpCode::Sub:
+		return left - right;
+	case OpCode::Mul:
+		return left * right;
+	case OpCode::Div:
+		return left / right;
+	case OpCode::Pow:
+		return pow(left, right);
+	case OpCode::Neg:
+		return -right;
+	case OpCode::Sqr:
+		return right * right;
+	case OpCode::Cube:
+		return right * right * right;
+	case OpCode::Sin:
+		return sin(right);
+	case OpCode::Exp:
+		return exp(right);
+	case OpCode::Log:
+		return log(right);
+	default:
+		return right;
+	}
+}
+
+/* Single pass peephole optimizer over the postfix program:
+ *  - folds operators whose operands are all constants;
+ *  - merges constants into chains such as (x*2)*3 and (x+1)+2;
+ *  - removes identities (+0, -0, *1, /1, ^1, 0+, 1*) and double negations;
+ *  - turns x^2 and x^3 into multiplies.
+ * spans holds, for every value on the simulated stack, the index of its first instruction.
+ */
+template<typename I, typename O>
+void Evaluator<I, O>::optimize()
+{
+	std::vector<Instruction> out;
+	std::vector<size_t> spans;
+	out.reserve(program.size());
+
+	auto isConst = [&out](size_t begin, size_t end) -> bool
+	{
+		return end - begin == 1 && out[begin].code == OpCode::PushConst;
+	};
+
+	for (const Instruction& ins : program)
+	{
+		if (isPush(ins.code))
+		{
+			spans.push_back(out.size());
+			out.push_back(ins);
+		}
+		else if (!isBinary(ins.code))
+		{
+			const size_t s = spans.back();
+			if (isConst(s, out.size()))
+				out[s].value = applyOP(ins.code, I(0), out[s].value);
+			else if (ins.code == OpCode::Neg && out.back().code == OpCode::Neg)
+				out.pop_back();
+			else
+				out.push_back(ins);
+		}
+		else
+		{
+			const size_t sR = spans.back(); spans.pop_back();
+			const size_t sL = spans.back();
+			const bool lConst = isConst(sL, sR);
+			const bool rConst = isConst(sR, out.size());
+			const I l = out[sL].value;
+			const I r = out[sR].value;
+
+			if (lConst && rConst)
+			{
+				out[sL].value = applyOP(ins.code, l, r);
+				out.pop_back();
+			}
+			else if (rConst)
+			{
+				//Left operand is itself (A op c) with the same associative op -> fold into c
+				const bool chain = (ins.code == OpCode::Mul || ins.code == OpCode::Add)
+					&& sR - sL >= 3 && out[sR - 1].code == ins.code && out[sR - 2].code == OpCode::PushConst;
+
+				if (chain)
+				{
+					out[sR - 2].value = applyOP(ins.code, out[sR - 2].value, r);
+					out.pop_back();
+				}
+				else if ((ins.code == OpCode::Add || ins.code == OpCode::Sub) && r == I(0)
+					|| (ins.code == OpCode::Mul || ins.code == OpCode::Div || ins.code == OpCode::Pow) && r == I(1))
+				{
+					out.pop_back();
+				}
+				else if (ins.code == OpCode::Pow && r == I(2))
+				{
+					out.back().code = OpCode::Sqr;
+				}
+				else if (ins.code == OpCode::Pow && r == I(3))
+				{
+					out.back().code = OpCode::Cube;
+				}
+				else
+				{
+					out.push_back(ins);
+				}
+			}
+			else if (lConst && (ins.code == OpCode::Add && l == I(0) || ins.code == OpCode::Mul && l == I(1)))
+			{
+				out.erase(out.begin() + sL);
+			}
+			else if (lConst && ins.code == OpCode::Sub && l == I(0))
+			{
+				out.erase(out.begin() + sL);
+				out.push_back({ OpCode::Neg, I(0), 0 });
+			}
+			else
+			{
+				out.push_back(ins);
+			}
+		}
+	}
+
+	program.swap(out);
+
+	//Folding can only shrink the stack, recompute what the runtime needs
+	depth = 0;
+	maxDepth = 0;
+	for (const Instruction& ins : program)
+	{
+		if (isPush(ins.code))
+			depth++;
+		else if (isBinary(ins.code))
+			depth--;
+		maxDepth = std::max(maxDepth, depth);
+	}
+}
+
+template<typename I, typename O>
+I Evaluator<I, O>::runProgram(const std::vector<Instruction>& prog)
+{
+	if (prog.empty())
+		return I(0);
+
+	I* stack = valueStack.data();
+	int top = -1;
+
+	for (const Instruction& ins : prog)
+	{
+		switch (ins.code)
+		{
+		case OpCode::PushConst:
+			stack[++top] = ins.value;
+			break;
+		case OpCode::PushX:
+			stack[++top] = xVal;
+			break;
+		case OpCode::PushY:
+			stack[++top] = yVal;
+			break;
+		case OpCode::PushZ:
+			stack[++top] = zVal;
+			break;
+		case OpCode::PushT:
+			stack[++top] = tVal;
+			break;
+		case OpCode::PushCached:
+			assert(false && "Cached grid values have no scalar meaning");
+			break;
+		case OpCode::PushUniform:
+			stack[++top] = uniformValues[ins.index];
+			break;
+		case OpCode::Add:
+			stack[top - 1] = stack[top - 1] + stack[top]; top--;
+			break;
+		case OpCode::Sub:
+			stack[top - 1] = stack[top - 1] - stack[top]; top--;
+			break;
+		case OpCode::Mul:
+			stack[top - 1] = stack[top - 1] * stack[top]; top--;
+			break;
+		case OpCode::Div:
+			stack[top - 1] = stack[top - 1] / stack[top]; top--;
+			break;
+		case OpCode::Pow:
+			stack[top - 1] = pow(stack[top - 1], stack[top]); top--;
+			break;
+		case OpCode::Neg:
+			stack[top] = -stack[top];
+			break;
+		case OpCode::Sqr:
+			stack[top] = stack[top] * stack[top];
+			break;
+		case OpCode::Cube:
+			stack[top] = stack[top] * stack[top] * stack[top];
+			break;
+		case OpCode::Sin:
+			stack[top] = sin(stack[top]);
+			break;
+		case OpCode::Exp:
+			stack[top] = exp(stack[top]);
+			break;
+		case OpCode::Log:
+			stack[top] = log(stack[top]);
+			break;
+		}
+	}
+
+	return stack[top];
+}
+
+template<typename I, typename O>
+template<typename T>
+void Evaluator<I, O>::runBlocks(const std::vector<Instruction>& prog, const I* xs, const I* ys, const I* zs, T* out, size_t n)
+{
+	if (prog.empty())
+	{
+		std::fill(out, out + n, T(0));
+		return;
+	}
+
+	for (size_t base = 0; base < n; base += BLOCK)
+	{
+		const size_t m = (n - base < BLOCK) ? n - base : BLOCK;
+		I* stack = blockStack.data();
+		int top = -1;
+
+		//Each operator sweeps the whole block - plain unit stride loops the compiler can vectorize
+		for (const Instruction& ins : prog)
+		{
+			I* b = (top >= 0) ? stack + top * BLOCK : nullptr; //Top slot
+			I* a = (top >= 1) ? stack + (top - 1) * BLOCK : nullptr; //Slot below the top
+			I* c = stack + (top + 1) * BLOCK; //Next free slot
+
+			switch (ins.code)
+			{
+			case OpCode::PushConst:
+				std::fill(c, c + m, ins.value); top++;
+				break;
+			case OpCode::PushX:
+				assert(xs != nullptr);
+				std::copy(xs + base, xs + base + m, c); top++;
+				break;
+			case OpCode::PushY:
+				assert(ys != nullptr);
+				std::copy(ys + base, ys + base + m, c); top++;
+				break;
+			case OpCode::PushZ:
+				assert(zs != nullptr);
+				std::copy(zs + base, zs + base + m, c); top++;
+				break;
+			case OpCode::PushT:
+				std::fill(c, c + m, tVal); top++;
+				break;
+			case OpCode::PushCached:
+			{
+				const I* row = gridCache.data() + ins.index * gridSize + base;
+				std::copy(row, row + m, c); top++;
+				break;
+			}
+			case OpCode::PushUniform:
+				std::fill(c, c + m, uniformValues[ins.index]); top++;
+				break;
+			case OpCode::Add:
+				for (size_t k = 0; k < m; k++) a[k] = a[k] + b[k];
+				top--;
+				break;
+			case OpCode::Sub:
+				for (size_t k = 0; k < m; k++) a[k] = a[k] - b[k];
+				top--;
+				break;
+			case OpCode::Mul:
+				for (size_t k = 0; k < m; k++) a[k] = a[k] * b[k];
+				top--;
+				break;
+			case OpCode::Div:
+				for (size_t k = 0; k < m; k++) a[k] = a[k] / b[k];
+				top--;
+				break;
+			case OpCode::Pow:
+				for (size_t k = 0; k < m; k++) a[k] = pow(a[k], b[k]);
+				top--;
+				break;
+			case OpCode::Neg:
+				for (size_t k = 0; k < m; k++) b[k] = -b[k];
+				break;
+			case OpCode::Sqr:
+				for (size_t k = 0; k < m; k++) b[k] = b[k] * b[k];
+				break;
+			case OpCode::Cube:
+				for (size_t k = 0; k < m; k++) b[k] = b[k] * b[k] * b[k];
+				break;
+			case OpCode::Sin:
+				for (size_t k = 0; k < m; k++) b[k] = sin(b[k]);
+				break;
+			case OpCode::Exp:
+				for (size_t k = 0; k < m; k++) b[k] = exp(b[k]);
+				break;
+			case OpCode::Log:
+				for (size_t k = 0; k < m; k++) b[k] = log(b[k]);
+				break;
+			}
+		}
+
+		for (size_t k = 0; k < m; k++)
+			out[base + k] = T(stack[k]);
+	}
+}
+
+template<typename I, typename O>
+void Evaluator<I, O>::buildDerivative()
+{
+	//Forward mode: mark which stack values depend on the chosen variable so the
+	//derivative pass only carries tangents that can be non zero
+	std::vector<bool> active;
+	activity.assign(program.size(), 0);
+
+	for (size_t p = 0; p < program.size(); p++)
+	{
+		const OpCode code = program[p].code;
+		if (isPush(code))
+		{
+			active.push_back(code == dVar);
+			activity[p] = active.back() ? ACTIVE_LEFT : 0;
+		}
+		else if (isBinary(code))
+		{
+			const bool r = active.back(); active.pop_back();
+			const bool l = active.back();
+			activity[p] = (l ? ACTIVE_LEFT : 0) | (r ? ACTIVE_RIGHT : 0);
+			active.back() = l || r;
+		}
+		else
+		{
+			activity[p] = active.back() ? ACTIVE_LEFT : 0;
+		}
+	}
+
+	resultActive = !active.empty() && active.back();
+	dBlockStack.assign(std::max(maxDepth, 1u) * BLOCK, I(0));
+}
+
+template<typename I, typename O>
+void Evaluator<I, O>::runDualBlocks(const I* xs, const I* ys, const I* zs, O* out, O* dout, size_t n)
+{
+	if (program.empty())
+	{
+		if (out != nullptr)
+			std::fill(out, out + n, O(0));
+		std::fill(dout, dout + n, O(0));
+		return;
+	}
+
+	for (size_t base = 0; base < n; base += BLOCK)
+	{
+		const size_t m = (n - base < BLOCK) ? n - base : BLOCK;
+		I* stack = blockStack.data();
+		I* dstack = dBlockStack.data();
+		int top = -1;
+
+		for (size_t p = 0; p < program.size(); p++)
+		{
+			const Instruction& ins = program[p];
+			const unsigned char act = activity[p];
+			const size_t ib = (top >= 0) ? top * BLOCK : 0;
+			const size_t ia = (top >= 1) ? (top - 1) * BLOCK : 0;
+			const size_t ic = (top + 1) * BLOCK;
+			I* a = stack + ia; I* da = dstack + ia;
+			I* b = stack + ib; I* db = dstack + ib;
+			I* c = stack + ic; I* dc = dstack + ic;
+
+			switch (ins.code)
+			{
+			case OpCode::PushConst:
+				std::fill(c, c + m, ins.value); top++;
+				break;
+			case OpCode::PushX:
+				assert(xs != nullptr);
+				std::copy(xs + base, xs + base + m, c); top++;
+				break;
+			case OpCode::PushY:
+				assert(ys != nullptr);
+				std::copy(ys + base, ys + base + m, c); top++;
+				break;
+			case OpCode::PushZ:
+				assert(zs != nullptr);
+				std::copy(zs + base, zs + base + m, c); top++;
+				break;
+			case OpCode::PushT:
+				std::fill(c, c + m, tVal); top++;
+				break;
+			case OpCode::PushCached:
+			case OpCode::PushUniform:
+				assert(false && "The derivative pass runs on the full program only");
+				break;
+			case OpCode::Add:
+				if (act == (ACTIVE_LEFT | ACTIVE_RIGHT))
+					for (size_t k = 0; k < m; k++) da[k] = da[k] + db[k];
+				else if (act == ACTIVE_RIGHT)
+					std::copy(db, db + m, da);
+				for (size_t k = 0; k < m; k++) a[k] = a[k] + b[k];
+				top--;
+				break;
+			case OpCode::Sub:
+				if (act == (ACTIVE_LEFT | ACTIVE_RIGHT))
+					for (size_t k = 0; k < m; k++) da[k] = da[k] - db[k];
+				else if (act == ACTIVE_RIGHT)
+					for (size_t k = 0; k < m; k++) da[k] = -db[k];
+				for (size_t k = 0; k < m; k++) a[k] = a[k] - b[k];
+				top--;
+				break;
+			case OpCode::Mul:
+				if (act == (ACTIVE_LEFT | ACTIVE_RIGHT))
+					for (size_t k = 0; k < m; k++) da[k] = da[k] * b[k] + a[k] * db[k];
+				else if (act == ACTIVE_LEFT)
+					for (size_t k = 0; k < m; k++) da[k] = da[k] * b[k];
+				else if (act == ACTIVE_RIGHT)
+					for (size_t k = 0; k < m; k++) da[k] = a[k] * db[k];
+				for (size_t k = 0; k < m; k++) a[k] = a[k] * b[k];
+				top--;
+				break;
+			case OpCode::Div:
+				for (size_t k = 0; k < m; k++) a[k] = a[k] / b[k];
+				if (act == (ACTIVE_LEFT | ACTIVE_RIGHT))
+					for (size_t k = 0; k < m; k++) da[k] = (da[k] - a[k] * db[k]) / b[k];
+				else if (act == ACTIVE_LEFT)
+					for (size_t k = 0; k < m; k++) da[k] = da[k] / b[k];
+				else if (act == ACTIVE_RIGHT)
+					for (size_t k = 0; k < m; k++) da[k] = -a[k] * db[k] / b[k];
+				top--;
+				break;
+			case OpCode::Pow:
+				//d(a^b) = b*a^(b-1)*da + a^b*log(a)*db - the log term only when the exponent varies
+				for (size_t k = 0; k < m; k++)
+				{
+					const I v = pow(a[k], b[k]);
+					if (act == (ACTIVE_LEFT | ACTIVE_RIGHT))
+						da[k] = b[k] * pow(a[k], b[k] - I(1)) * da[k] + v * log(a[k]) * db[k];
+					else if (act == ACTIVE_LEFT)
+						da[k] = b[k] * pow(a[k], b[k] - I(1)) * da[k];
+					else if (act == ACTIVE_RIGHT)
+						da[k] = v * log(a[k]) * db[k];
+					a[k] = v;
+				}
+				top--;
+				break;
+			case OpCode::Neg:
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = -db[k];
+				for (size_t k = 0; k < m; k++) b[k] = -b[k];
+				break;
+			case OpCode::Sqr:
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = I(2) * b[k] * db[k];
+				for (size_t k = 0; k < m; k++) b[k] = b[k] * b[k];
+				break;
+			case OpCode::Cube:
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = I(3) * b[k] * b[k] * db[k];
+				for (size_t k = 0; k < m; k++) b[k] = b[k] * b[k] * b[k];
+				break;
+			case OpCode::Sin:
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = cos(b[k]) * db[k];
+				for (size_t k = 0; k < m; k++) b[k] = sin(b[k]);
+				break;
+			case OpCode::Exp:
+				for (size_t k = 0; k < m; k++) b[k] = exp(b[k]);
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = b[k] * db[k];
+				break;
+			case OpCode::Log:
+				if (act)
+					for (size_t k = 0; k < m; k++) db[k] = db[k] / b[k];
+				for (size_t k = 0; k < m; k++) b[k] = log(b[k]);
+				break;
+			}
+
+			//Seed the tangent of the variable we differentiate against
+			if (act && ins.code == dVar)
+				std::fill(dc, dc + m, I(1));
+		}
+
+		for (size_t k = 0; k < m; k++)
+		{
+			if (out != nullptr)
+				out[base + k] = O(stack[k]);
+			dout[base + k] = resultActive ? O(dstack[k]) : O(0);
+		}
+	}
+}
+
+template<typename I, typename O>
+void Evaluator<I, O>::bindGrid(const I* xs, size_t n)
+{
+	//The grid only carries x, so y and z would have nothing to be sampled on
+	for (const Instruction& ins : program)
+	{
+		if (ins.code == OpCode::PushY || ins.code == OpCode::PushZ)
+		{
+			throw std::invalid_argument("bindGrid needs an expression of x and t only, y and z are not sampled on the grid");
+		}
+	}
+
+	timeProgram.clear();
+	uniformPrograms.clear();
+	gridPrograms.clear();
+	gridSize = n;
+
+	if (program.empty())
+		return;
+
+	//For every instruction: first instruction of the subexpression it closes and what that subexpression depends on
+	std::vector<size_t> starts(program.size());
+	std::vector<unsigned char> deps(program.size());
+	std::vector<size_t> spans;
+
+	for (size_t p = 0; p < program.size(); p++)
+	{
+		const OpCode code = program[p].code;
+		if (isPush(code))
+		{
+			spans.push_back(p);
+			starts[p] = p;
+			deps[p] = (code == OpCode::PushT) ? DEPENDS_TIME : (code == OpCode::PushConst) ? 0 : DEPENDS_GRID;
+		}
+		else if (isBinary(code))
+		{
+			const size_t sR = spans.back(); spans.pop_back();
+			starts[p] = spans.back();
+			deps[p] = deps[p - 1] | deps[sR - 1];
+		}
+		else
+		{
+			starts[p] = spans.back();
+			deps[p] = deps[p - 1];
+		}
+	}
+
+	splitTime(starts, deps, program.size() - 1);
+
+	//Sample every x only subexpression on the grid once
+	gridCache.assign(gridPrograms.size() * n, I(0));
+	for (size_t j = 0; j < gridPrograms.size(); j++)
+	{
+		runBlocks(gridPrograms[j], xs, nullptr, nullptr, gridCache.data() + j * n, n);
+	}
+
+	uniformValues.assign(uniformPrograms.size(), I(0));
+}
+
+/* Rebuilds the subexpression ending at instruction end into timeProgram: maximal x only
+ * subtrees become PushCached, maximal t only subtrees become PushUniform, the rest is copied.
+ */
+template<typename I, typename O>
+void Evaluator<I, O>::splitTime(const std::vector<size_t>& starts, const std::vector<unsigned char>& deps, size_t end)
+{
+	const size_t begin = starts[end];
+	const OpCode code = program[end].code;
+
+	if (deps[end] == DEPENDS_GRID)
+	{
+		timeProgram.push_back({ OpCode::PushCached, I(0), (uint)gridPrograms.size() });
+		gridPrograms.emplace_back(program.begin() + begin, program.begin() + end + 1);
+	}
+	else if (deps[end] == DEPENDS_TIME)
+	{
+		timeProgram.push_back({ OpCode::PushUniform, I(0), (uint)uniformPrograms.size() });
+		uniformPrograms.emplace_back(program.begin() + begin, program.begin() + end + 1);
+	}
+	else if (deps[end] == 0 || isPush(code))
+	{
+		timeProgram.insert(timeProgram.end(), program.begin() + begin, program.begin() + end + 1);
+	}
+	else if (isBinary(code))
+	{
+		splitTime(starts, deps, starts[end - 1] - 1); //Left operand ends right before the right one starts
+		splitTime(starts, deps, end - 1);
+		timeProgram.push_back(program[end]);
+	}
+	else
+	{
+		splitTime(starts, deps, end - 1);
+		timeProgram.push_back(program[end]);
+	}
+}
+
+template<typename I, typename O>
+void Evaluator<I, O>::evaluateAt(I t, O* out)
+{
+	assert(gridSize > 0 || program.empty());
+
+	tVal = t;
+
+	//Time only terms are scalars for the whole grid
+	for (size_t j = 0; j < uniformPrograms.size(); j++)
+	{
+		uniformValues[j] = runProgram(uniformPrograms[j]);
+	}
+
+	runBlocks(timeProgram, nullptr, nullptr, nullptr, out, gridSize);
+}
@@ -0,0 +1,180 @@
+#include "FFT.h"
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <assert.h>
+
+static const double PI = 3.14159265358979323846;
+
+FFT::FFT(uint N) : n(N), bluestein((N & (N - 1)) != 0), m(N)
+{
+	assert(N > 0);
+
+	if (bluestein)
+	{
+		m = 1;
+		while (m < 2 * N - 1)
+			m <<= 1;
+	}
+
+	//Bit reversal swaps
+	uint bits = 0;
+	while ((1u << bits) < m)
+		bits++;
+
+	for (uint i = 0; i < m; i++)
+	{
+		uint j = 0;
+		for (uint b = 0; b < bits; b++)
+		{
+			j |= ((i >> b) & 1u) << (bits - 1 - b);
+		}
+
+		if (i < j)
+		{
+			reversal.push_back(i);
+			reversal.push_back(j);
+		}
+	}
+
+	//Twiddles per stage: w_{2h}^j, j < h
+	twiddlesForward.resize(m > 1 ? m - 1 : 0);
+	twiddlesInverse.resize(twiddlesForward.size());
+	for (uint h = 1; h < m; h <<= 1)
+	{
+		for (uint j = 0; j < h; j++)
+		{
+			double angle = PI * j / h;
+			twiddlesForward[h - 1 + j] = Complex(cos(angle), -sin(angle));
+			twiddlesInverse[h - 1 + j] = Complex(cos(angle), sin(angle));
+		}
+	}
+
+	if (bluestein)
+	{
+		chirp.resize(n);
+		for (uint k = 0; k < n; k++)
+		{
+			//k^2 mod 2n keeps the angle small (and exact) for large k
+			unsigned long long k2 = ((unsigned long long)k * k) % (2ull * n);
+			double angle = PI * (double)k2 / n;
+			chirp[k] = Complex(cos(angle), -sin(angle));
+		}
+
+		chirpSpectrum.assign(m, Complex(0.0));
+		chirpSpectrum[0] = std::conj(chirp[0]);
+		for (uint k = 1; k < n; k++)
+		{
+			chirpSpectrum[k] = chirpSpectrum[m - k] = std::conj(chirp[k]);
+		}
+
+		radix2(chirpSpectrum.data(), twiddlesForward);
+
+		//Fold the 1 / m of the convolution's inverse transform in here
+		for (uint k = 0; k < m; k++)
+		{
+			chirpSpectrum[k] /= (double)m;
+		}
+	}
+}
+
+std::shared_ptr<const FFT> FFT::plan(uint N)
+{
+	//Least recently used sizes are dropped past the capacity, callers keep theirs alive through the shared_ptr
+	static const size_t capacity = 16;
+	static std::mutex mtx;
+	static std::list<std::pair<uint, std::shared_ptr<const FFT>>> plans; //Most recent first
+	static std::unordered_map<uint, decltype(plans)::iterator> index;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	auto it = index.find(N);
+	if (it != index.end())
+	{
+		plans.splice(plans.begin(), plans, it->second);
+		return plans.front().second;
+	}
+
+	plans.emplace_front(N, std::make_shared<const FFT>(N));
+	index[N] = plans.begin();
+
+	while (plans.size() > capacity)
+	{
+		index.erase(plans.back().first);
+		plans.pop_back();
+	}
+
+	return plans.front().second;
+}
+
+void FFT::forward(Complex* data, Complex* scratch) const
+{
+	if (bluestein)
+		chirpZ(data, scratch);
+	else
+		radix2(data, twiddlesForward);
+}
+
+void FFT::inverse(Complex* data, Complex* scratch) const
+{
+	if (!bluestein)
+	{
+		radix2(data, twiddlesInverse);
+		return;
+	}
+
+	//ifft(x) = conj(fft(conj(x)))
+	for (uint k = 0; k < n; k++)
+		data[k] = std::conj(data[k]);
+
+	chirpZ(data, scratch);
+
+	for (uint k = 0; k < n; k++)
+		data[k] = std::conj(data[k]);
+}
+
+void FFT::radix2(Complex* data, const std::vector<Complex>& twiddles) const
+{
+	for (size_t s = 0; s < reversal.size(); s += 2)
+	{
+		std::swap(data[reversal[s]], data[reversal[s + 1]]);
+	}
+
+	for (uint h = 1; h < m; h <<= 1)
+	{
+		const Complex* w = &twiddles[h - 1];
+		for (uint k = 0; k < m; k += 2 * h)
+		{
+			Complex* a = data + k;
+			Complex* b = data + k + h;
+			for (uint j = 0; j < h; j++)
+			{
+				//Written out: std::complex's operator* carries the inf/nan recovery path, which blocks vectorization
+				double re = b[j].real() * w[j].real() - b[j].imag() * w[j].imag();
+				double im = b[j].real() * w[j].imag() + b[j].imag() * w[j].real();
+				Complex t(re, im);
+				b[j] = a[j] - t;
+				a[j] += t;
+			}
+		}
+	}
+}
+
+void FFT::chirpZ(Complex* data, Complex* scratch) const
+{
+	assert(scratch != nullptr);
+
+	//a_k = x_k * chirp_k, zero padded to m
+	for (uint k = 0; k < n; k++)
+		scratch[k] = data[k] * chirp[k];
+	for (uint k = n; k < m; k++)
+		scratch[k] = 0.0;
+
+	//Circular convolution with the conjugated chirp
+	radix2(scratch, twiddlesForward);
+	for (uint k = 0; k < m; k++)
+		scratch[k] *= chirpSpectrum[k];
+	radix2(scratch, twiddlesInverse);
+
+	for (uint k = 0; k < n; k++)
+		data[k] = scratch[k] * chirp[k];
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <complex>
+#include <vector>
+#include <memory>
+
+typedef unsigned int uint;
+typedef std::complex<double> Complex;
+
+/* Discrete Fourier transform of any length N.
+ * Powers of two run an iterative radix-2 Cooley-Tukey with the bit reversal permutation and the
+ * twiddles of every stage precomputed (contiguous per stage, so the butterfly loop is unit stride).
+ * Other lengths go through Bluestein's chirp-z on a power of two transform of size >= 2N - 1.
+ * A plan is immutable after construction: it can be shared between threads as long as each one
+ * passes its own scratch.
+ */
+class FFT
+{
+public:
+	explicit FFT(uint N);
+	~FFT() = default;
+
+	//Cached plan for the size N (built on first use, thread safe, the 16 most recently used sizes are kept)
+	static std::shared_ptr<const FFT> plan(uint N);
+
+	/* INPUT: data - N values, transformed in place; scratch - scratchSize() values (unused for powers of two)
+	* OUTPUT: X_k = sum_j x_j exp(-2 pi i jk / N)
+	*/
+	void forward(Complex* data, Complex* scratch = nullptr) const;
+
+	//Unnormalized inverse: x_j = sum_k X_k exp(+2 pi i jk / N)
+	void inverse(Complex* data, Complex* scratch = nullptr) const;
+
+	uint size() const
+	{
+		return n;
+	}
+
+	uint scratchSize() const
+	{
+		return bluestein ? m : 0;
+	}
+
+private:
+	//In place radix-2 transform of a power of two length
+	void radix2(Complex* data, const std::vector<Complex>& twiddles) const;
+
+	void chirpZ(Complex* data, Complex* scratch) const;
+
+	uint n;
+	bool bluestein;
+
+	//Radix-2 tables (size m = n, or the padded size for Bluestein)
+	uint m;
+	std::vector<uint> reversal; //Pairs (i, j), i < j, to swap
+	std::vector<Complex> twiddlesForward; //Stage with half size h starts at [h - 1]
+	std::vector<Complex> twiddlesInverse;
+
+	//Bluestein tables
+	std::vector<Complex> chirp; //exp(-i pi k^2 / n)
+	std::vector<Complex> chirpSpectrum; //FFT of the conjugated chirp, already divided by m
+};
@@ -1,8 +1,93 @@
 #include "Solver.h"
+#include "../ThreadPool.h"
 
-Vector Solver::FDM(double S, uint N, Potential U)
+Spectrum Solver::FDM(double S, uint N, Potential U, bool states)
+{
+	const uint n = N - 2; //Interior points, the borders are fixed at 0
+
+	//Scratch of the eigen solvers comes from this thread's arena, all of it is given back on return
+	Arena::Scope scratch(Arena::local());
+
+	//The Hamiltonian H = U + F is tri-diagonal: keep only the diagonal and the off diagonal
+	TridiagonalMatrix H = buildHamiltonian(S, N, U);
+
+	Spectrum spectrum;
+	spectrum.count = n;
+	spectrum.dimension = n;
+	spectrum.energies.resize(n);
+
+	if (states)
+		spectrum.states.resize((size_t)n * n);
+
+	//Solve the eigenvalues and eigenvectors - with default boundary equations X[0] == X[N] == 0
+	//Full spectra go through the parallel divide and conquer, energies alone through QL (O(N^2))
+	H.diagonalize(spectrum.energies.data(), states ? spectrum.states.data() : nullptr);
+
+	return spectrum;
+}
+
+Spectrum Solver::FDMPartial(double S, uint N, Potential U, uint k)
+{
+	return solvePartial(buildHamiltonian(S, N, U), 0, std::min(k, N - 2));
+}
+
+Spectrum Solver::FDMPartial(double S, uint N, Potential U, double Emin, double Emax)
+{
+	TridiagonalMatrix H = buildHamiltonian(S, N, U);
+
+	//The Sturm counts at both ends of the window give the indices of the states inside it
+	const int first = H.sturmCount(Emin);
+	const int last = H.sturmCount(Emax);
+
+	return solvePartial(H, first, std::max(last - first, 0));
+}
+
+Spectrum Solver::FDMContinue(double S, uint N, Potential U, const Spectrum& previous)
+{
+	const uint n = N - 2;
+	const uint count = std::min(previous.count, n);
+
+	if (previous.dimension != n || previous.states.size() < (size_t)count * n)
+		return FDMPartial(S, N, U, count);
+
+	Arena::Scope scratch(Arena::local());
+	TridiagonalMatrix H = buildHamiltonian(S, N, U);
+
+	Spectrum spectrum;
+	spectrum.count = count;
+	spectrum.dimension = n;
+	spectrum.energies.resize(count);
+	spectrum.states.assign(previous.states.begin(), previous.states.begin() + (size_t)count * n);
+
+	if (count == 0)
+		return spectrum;
+
+	//Close levels (same rule as solvePartial, on the old energies) are kept orthogonal to each other
+	const double separation = 1e-3 * std::max(fabs(previous.energies[0]), fabs(previous.energies[count - 1]));
+	//Rounding slack of the Sturm counts, on the scale of the whole matrix (not of its first row)
+	const double tiny = DBL_EPSILON * H.norm();
+
+	uint cluster = 0;
+	for (uint k = 0; k < count; k++)
+	{
+		if (k > 0 && previous.energies[k] - previous.energies[k - 1] > separation)
+			cluster = k;
+
+		double residual;
+		double E = H.refine(spectrum.state(k), (k > cluster) ? spectrum.state(cluster) : nullptr, k - cluster, &residual);
+
+		//The residual bounds the distance to the nearest eigenvalue: it has to be the k-th one
+		if (H.sturmCount(E - residual - tiny) != (int)k || H.sturmCount(E + residual + tiny) != (int)k + 1)
+			return solvePartial(H, 0, count);
+
+		spectrum.energies[k] = E;
+	}
+
+	return spectrum;
+}
+
+TridiagonalMatrix Solver::buildHamiltonian(double S, uint N, Potential U)
 {
-	const double rightBorder = S;
 	const double leftBorder = 0.0;
 
 	const double step = S / (N - 1);
@@ -11,44 +96,503 @@ Vector Solver::FDM(double S, uint N, Potential U)
 	const double hbar = 1; //Natural units system
 	const double t_0 = hbar * hbar / (2 * m * step * step);
 
-	Matrix U_m(N - 2);
-	Matrix F_m(N - 2);
+	const uint n = N - 2;
+
+	TridiagonalMatrix H(n);
+
+	//Potential on the diagonal plus the FDM 2nd derivative approx (Tri-diagonal)
+	for (uint i = 0; i < n; i++)
+	{
+		H.diagonal[i] = 2 * t_0 + U(leftBorder + step * (i + 1));
+		H.offdiagonal[i] = -t_0;
+	}
+
+	return H;
+}
+
+Spectrum Solver::solvePartial(const TridiagonalMatrix& H, uint first, uint count)
+{
+	const int n = H.dimension();
+
+	//Every inverse iteration factors T - E*I into the arena: one set of buffers reused for all states
+	Arena::Scope scratch(Arena::local());
+
+	Spectrum spectrum;
+	spectrum.count = count;
+	spectrum.dimension = n;
+	spectrum.energies.resize(count);
+	spectrum.states.resize((size_t)count * n);
+
+	if (count == 0)
+		return spectrum;
+
+	H.eigenvalues(first, first + count - 1, spectrum.energies.data());
+
+	//Scale under which two energies are treated as one cluster and their states orthogonalized
+	const double separation = 1e-3 * std::max(fabs(spectrum.energies[0]), fabs(spectrum.energies[count - 1]));
+
+	uint cluster = 0;
+	for (uint k = 0; k < count; k++)
+	{
+		if (k > 0 && spectrum.energies[k] - spectrum.energies[k - 1] > separation)
+			cluster = k;
+
+		H.eigenvector(spectrum.energies[k], spectrum.state(k), (k > cluster) ? spectrum.state(cluster) : nullptr, k - cluster);
+	}
+
+	return spectrum;
+}
 
-	//Construct the potential matrix
-	for (int i = 0; i < N - 2; i++)
+Spectrum Solver::Numerov(double S, uint N, Potential U, uint k, bool parallel)
+{
+	const double step = S / (N - 1);
+	const uint n = N - 2;
+	k = std::min(k, n);
+
+	std::vector<double> potential(N);
+	for (uint i = 0; i < N; i++)
 	{
-		U_m[i][i] = U(step * i);
+		potential[i] = U(step * i);
 	}
 
-	//Construct the FDM 2nd derivative approx matrix (Tri-diagonal matrix)
-	for (int i = 0; i < N - 2; i++)
+	Spectrum spectrum;
+	spectrum.count = k;
+	spectrum.dimension = n;
+	spectrum.energies.resize(k);
+	spectrum.states.resize((size_t)k * n);
+
+	const double Umin = *std::min_element(potential.begin(), potential.end());
+
+	//Every state is an independent search: state j is where the node count steps from j to j + 1
+	auto search = [&](size_t begin, size_t end)
 	{
-		for (int j = 0; j < N - 2; j++)
+		for (size_t j = begin; j < end; j++)
 		{
-			if (i == j)
-				F_m[i][j] = 2 * t_0;
-			else if (i == j + 1 || i + 1 == j)
-				F_m[i][j] = -t_0;
-			else
-				continue;
+			double lower = Umin;
+			double width = 1.0;
+			while (numerovNodes(potential, step, Umin + width) <= j && width < 1e300)
+			{
+				width *= 2.0;
+			}
+			double upper = Umin + width;
+
+			while (upper - lower > 4.0 * DBL_EPSILON * std::max(fabs(lower), fabs(upper)))
+			{
+				double mid = 0.5 * (lower + upper);
+				if (numerovNodes(potential, step, mid) > j) upper = mid;
+				else lower = mid;
+			}
+
+			spectrum.energies[j] = 0.5 * (lower + upper);
+			numerovState(potential, step, spectrum.energies[j], spectrum.state((uint)j));
+		}
+	};
+
+	if (parallel)
+		ThreadPool::global().parallelFor(0, k, 1, search);
+	else
+		search(0, k);
+
+	return spectrum;
+}
+
+Spectrum Solver::Relax(double S, uint N, Potential U, uint k, double tolerance, double dtau)
+{
+	const uint maxSteps = 100000;
+	const double PI = 3.14159265358979323846;
+	const uint n = N - 2;
+	k = std::min(k, n);
+
+	CrankNicolson propagator(S, N, U, dtau, true);
+
+	Spectrum spectrum;
+	spectrum.count = k;
+	spectrum.dimension = n;
+	spectrum.energies.resize(k);
+	spectrum.states.resize((size_t)k * n);
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	Complex* psi = arena.allocate<Complex>(n);
+	for (uint j = 0; j < k; j++)
+	{
+		//Box state j as the initial guess, plus an asymmetric term so no parity is missing
+		for (uint i = 0; i < n; i++)
+		{
+			double x = (double)(i + 1) / (N - 1);
+			psi[i] = sin((j + 1) * PI * x) + 1e-3 * x * x * (1.0 - x);
+		}
+
+		double E = propagator.energy(psi);
+		for (uint s = 0; s < maxSteps; s++)
+		{
+			propagator.step(psi);
+
+			//Gram-Schmidt against the lower states (all real) then renormalize
+			for (uint l = 0; l < j; l++)
+			{
+				const double* lower = spectrum.state(l);
+				double overlap = 0.0;
+				for (uint i = 0; i < n; i++)
+					overlap += lower[i] * psi[i].real();
+				for (uint i = 0; i < n; i++)
+					psi[i] -= overlap * lower[i];
+			}
+
+			double norm = 0.0;
+			for (uint i = 0; i < n; i++)
+				norm += std::norm(psi[i]);
+			norm = 1.0 / sqrt(norm);
+			for (uint i = 0; i < n; i++)
+				psi[i] *= norm;
+
+			double Enew = propagator.energy(psi);
+			bool converged = fabs(Enew - E) < tolerance;
+			E = Enew;
+
+			if (converged)
+				break;
 		}
+
+		spectrum.energies[j] = E;
+		double* state = spectrum.state(j);
+		for (uint i = 0; i < n; i++)
+			state[i] = psi[i].real();
 	}
 
-	//Construct the full Hamiltonian matrix
-	Matrix H_m = U_m + F_m;
+	return spectrum;
+}
 
-	//Solve the eigenvalues and eigenvectors - with default boundary equations X[0] == X[N] == 0
-	Matrix::calcEigenV(&H_m);
+SweepTable Solver::Sweep(double S, uint N, const PotentialFamily& U, double first, double last, uint count, uint levels)
+{
+	const double step = S / (N - 1);
 
-	double* evals = H_m.eigenValues();
-	double** evecs = H_m.eigenVectors();
+	return sweep(first, last, count, N, levels, [&]() -> Sampler
+	{
+		return [&, step](double parameter, double* potential)
+		{
+			for (uint i = 0; i < N - 2; i++)
+				potential[i] = U(step * (i + 1), parameter);
+			return S;
+		};
+	});
+}
 
-	Vector eigenvectors(N - 2);
+SweepTable Solver::Sweep(double S, uint N, const Evaluator<double, double>& U, double first, double last, uint count, uint levels)
+{
+	const double step = S / (N - 1);
 
-	for (int i = 0; i < N - 2; i++)
+	std::vector<double> xs(N - 2);
+	for (uint i = 0; i < N - 2; i++)
+		xs[i] = step * (i + 1);
+
+	return sweep(first, last, count, N, levels, [&]() -> Sampler
+	{
+		//The evaluator keeps its stacks inside, so every task runs its own copy
+		std::shared_ptr<Evaluator<double, double>> local = std::make_shared<Evaluator<double, double>>(U);
+
+		return [&, local](double parameter, double* potential)
+		{
+			local->setTime(parameter);
+			local->evaluate(xs.data(), potential, xs.size());
+			return S;
+		};
+	});
+}
+
+SweepTable Solver::SweepWidth(double Sfirst, double Slast, uint count, uint N, Potential U, uint levels)
+{
+	return sweep(Sfirst, Slast, count, N, levels, [&]() -> Sampler
 	{
-		*eigenvectors[i] = evecs[i][i];
+		return [&](double S, double* potential)
+		{
+			const double step = S / (N - 1);
+			for (uint i = 0; i < N - 2; i++)
+				potential[i] = U(step * (i + 1));
+			return S;
+		};
+	});
+}
+
+SweepTable Solver::sweep(double first, double last, uint count, uint N, uint levels, const std::function<Sampler()>& makeSampler)
+{
+	const uint n = N - 2;
+	levels = std::min(levels, n);
+
+	SweepTable table;
+	table.count = count;
+	table.levels = levels;
+	table.parameters.resize(count);
+	table.energies.resize((size_t)count * levels);
+
+	for (uint p = 0; p < count; p++)
+		table.parameters[p] = (count > 1) ? first + (last - first) * p / (count - 1) : first;
+
+	if (count == 0 || levels == 0)
+		return table;
+
+	ThreadPool::global().parallelFor(0, count, 1, [&](size_t begin, size_t end)
+	{
+		Sampler sample = makeSampler();
+		TridiagonalMatrix H(n);
+
+		for (size_t p = begin; p < end; p++)
+		{
+			//Potential straight into the diagonal, then the FDM 2nd derivative on top
+			double S = sample(table.parameters[p], H.diagonal.data());
+
+			const double step = S / (N - 1);
+			const double t_0 = 1.0 / (2 * step * step);
+			for (uint i = 0; i < n; i++)
+			{
+				H.diagonal[i] += 2 * t_0;
+				H.offdiagonal[i] = -t_0;
+			}
+
+			H.eigenvalues(0, levels - 1, table.row(static_cast<uint>(p)));
+		}
+	});
+
+	return table;
+}
+
+/* One step psi_(i-1), psi_i -> psi_(i+1) of psi'' = -g psi, g = 2(E - U), with c = step^2 / 12.
+ * Numerov's weights f = 1 + c g turn non positive deep in a forbidden region (step^2 (U - E) / 6 >= 1,
+ * tall walls or coarse grids): the recurrence then flips sign at every point and counts nodes that do
+ * not exist. Those points take the exponentially fitted step 2 cosh(kappa step) psi_i - psi_(i-1)
+ * instead, which grows or decays like the exact solution and never changes sign on its own.
+ */
+static double numerovStep(double psiPrev, double psi, double gPrev, double g, double gNext, double c, double step)
+{
+	const double fPrev = 1.0 + c * gPrev;
+	const double f = 1.0 + c * g;
+	const double fNext = 1.0 + c * gNext;
+
+	if (fPrev > 0.0 && f > 0.0 && fNext > 0.0)
+		return (2.0 * psi * (6.0 - 5.0 * f) - psiPrev * fPrev) / fNext;
+
+	//The cap keeps a single step finite (callers rescale past 1e150), only the growth direction matters there
+	const double kappaStep = std::min(sqrt(std::max(-g, 0.0)) * step, 300.0);
+	return 2.0 * cosh(kappaStep) * psi - psiPrev;
+}
+
+uint Solver::numerovNodes(const std::vector<double>& potential, double step, double E)
+{
+	const size_t N = potential.size();
+	const double c = step * step / 12.0;
+
+	//psi'' = -g psi with g = 2m(E - U)/hbar^2 (natural units)
+	double gPrev = 2.0 * (E - potential[0]);
+	double g = 2.0 * (E - potential[1]);
+	double psiPrev = 0.0;
+	double psi = step;
+	uint nodes = 0;
+
+	for (size_t i = 1; i < N - 1; i++)
+	{
+		double gNext = 2.0 * (E - potential[i + 1]);
+		double psiNext = numerovStep(psiPrev, psi, gPrev, g, gNext, c, step);
+
+		if (psiNext == 0.0 || (psiNext < 0.0) != (psi < 0.0))
+			nodes++;
+
+		//Only the sign matters here, keep the values away from overflow
+		if (fabs(psiNext) > 1e150)
+		{
+			psiNext *= 1e-150;
+			psi *= 1e-150;
+		}
+
+		psiPrev = psi; psi = (psiNext == 0.0) ? -psi * DBL_EPSILON : psiNext;
+		gPrev = g; g = gNext;
+	}
+
+	return nodes;
+}
+
+void Solver::numerovState(const std::vector<double>& potential, double step, double E, double* state)
+{
+	const int N = static_cast<int>(potential.size());
+	const double c = step * step / 12.0;
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	double* g = arena.allocate<double>(N);
+	for (int i = 0; i < N; i++)
+	{
+		g[i] = 2.0 * (E - potential[i]);
+	}
+
+	//Match where the solution decays into the right forbidden region (or near the right border)
+	int match = N - 2;
+	while (match > N / 2 && potential[match] > E)
+	{
+		match--;
+	}
+
+	double* psi = arena.allocate<double>(N);
+	std::fill(psi, psi + N, 0.0);
+	psi[1] = step;
+	for (int i = 1; i < match; i++)
+	{
+		psi[i + 1] = numerovStep(psi[i - 1], psi[i], g[i - 1], g[i], g[i + 1], c, step);
+		if (fabs(psi[i + 1]) > 1e150)
+		{
+			for (int j = 0; j <= i + 1; j++) psi[j] *= 1e-150;
+		}
+	}
+
+	if (match < N - 2)
+	{
+		double* right = arena.allocate<double>(N);
+		std::fill(right, right + N, 0.0);
+		right[N - 2] = step;
+		for (int i = N - 2; i > match; i--)
+		{
+			right[i - 1] = numerovStep(right[i + 1], right[i], g[i + 1], g[i], g[i - 1], c, step);
+			if (fabs(right[i - 1]) > 1e150)
+			{
+				for (int j = i - 1; j < N; j++) right[j] *= 1e-150;
+			}
+		}
+
+		const double scale = (right[match] != 0.0) ? psi[match] / right[match] : 0.0;
+		for (int i = match + 1; i < N - 1; i++)
+		{
+			psi[i] = right[i] * scale;
+		}
 	}
 
-	return eigenvectors;
+	double norm = 0.0;
+	for (int i = 1; i < N - 1; i++)
+	{
+		norm += psi[i] * psi[i];
+	}
+	norm = sqrt(norm);
+
+	for (int i = 1; i < N - 1; i++)
+	{
+		state[i - 1] = psi[i] / norm;
+	}
+}
+
+CrankNicolson::CrankNicolson(double S, uint N, Potential U, double dt, bool imaginaryTime) : dt(dt),
+	alpha(imaginaryTime ? Complex(dt, 0.0) : Complex(0.0, 0.5 * dt)),
+	beta(imaginaryTime ? Complex(0.0) : alpha)
+{
+	TridiagonalMatrix H = Solver::buildHamiltonian(S, N, U);
+	diagonal.swap(H.diagonal);
+	offdiagonal = H.offdiagonal.empty() ? 0.0 : H.offdiagonal[0];
+
+	//Gershgorin: no eigenvalue lies below min_i d_i - 2 |off|, so H - shift is positive semi definite
+	shift = 0.0;
+	if (imaginaryTime && !diagonal.empty())
+		shift = *std::min_element(diagonal.begin(), diagonal.end()) - 2.0 * fabs(offdiagonal);
+
+	const uint n = N - 2;
+	upper.resize(n);
+	pivot.resize(n);
+	forward.resize(n);
+
+	//Factor A = 1 + alpha (H - shift) once: a_i = c_i = alpha * off, b_i = 1 + alpha * (d_i - shift)
+	const Complex a = alpha * offdiagonal;
+	for (uint i = 0; i < n; i++)
+	{
+		Complex b = 1.0 + alpha * (diagonal[i] - shift);
+		Complex denom = (i == 0) ? b : b - a * upper[i - 1];
+		pivot[i] = 1.0 / denom;
+		upper[i] = a * pivot[i];
+	}
+}
+
+void CrankNicolson::step(Complex* psi, uint steps)
+{
+	const int n = static_cast<int>(diagonal.size());
+	const Complex a = alpha * offdiagonal;
+
+	for (uint s = 0; s < steps; s++)
+	{
+		//Forward sweep fused with the right hand side (1 - beta (H - shift)) psi
+		Complex prev = 0.0;
+		for (int i = 0; i < n; i++)
+		{
+			Complex Hpsi = (diagonal[i] - shift) * psi[i];
+			if (i > 0) Hpsi += offdiagonal * psi[i - 1];
+			if (i < n - 1) Hpsi += offdiagonal * psi[i + 1];
+
+			prev = (psi[i] - beta * Hpsi - a * prev) * pivot[i];
+			forward[i] = prev;
+		}
+
+		//Back substitution straight into psi
+		psi[n - 1] = forward[n - 1];
+		for (int i = n - 2; i >= 0; i--)
+		{
+			psi[i] = forward[i] - upper[i] * psi[i + 1];
+		}
+	}
+}
+
+double CrankNicolson::energy(const Complex* psi) const
+{
+	const int n = static_cast<int>(diagonal.size());
+
+	double E = 0.0, norm = 0.0;
+	for (int i = 0; i < n; i++)
+	{
+		Complex Hpsi = diagonal[i] * psi[i];
+		if (i > 0) Hpsi += offdiagonal * psi[i - 1];
+		if (i < n - 1) Hpsi += offdiagonal * psi[i + 1];
+
+		E += (std::conj(psi[i]) * Hpsi).real();
+		norm += std::norm(psi[i]);
+	}
+
+	return E / norm;
+}
+
+SplitOperator::SplitOperator(double S, uint N, Potential U, double dt) : fft(FFT::plan(N)), dt(dt)
+{
+	const double PI = 3.14159265358979323846;
+	const double step = S / N;
+
+	halfPotential.resize(N);
+	fullPotential.resize(N);
+	kinetic.resize(N);
+	scratch.resize(fft->scratchSize());
+
+	for (uint i = 0; i < N; i++)
+	{
+		double V = U(step * i);
+		halfPotential[i] = std::polar(1.0, -0.5 * V * dt);
+		fullPotential[i] = std::polar(1.0, -V * dt);
+
+		//FFT ordering: 0, 1, ..., N/2 - 1, -N/2, ..., -1
+		double k = 2.0 * PI / S * ((i < (N + 1) / 2) ? (double)i : (double)i - N);
+		kinetic[i] = std::polar(1.0 / N, -0.5 * k * k * dt);
+	}
+}
+
+void SplitOperator::step(Complex* psi, uint steps)
+{
+	const uint N = dimension();
+	if (steps == 0)
+		return;
+
+	for (uint i = 0; i < N; i++)
+		psi[i] *= halfPotential[i];
+
+	for (uint s = 0; s < steps; s++)
+	{
+		fft->forward(psi, scratch.data());
+		for (uint i = 0; i < N; i++)
+			psi[i] *= kinetic[i];
+		fft->inverse(psi, scratch.data());
+
+		const std::vector<Complex>& potential = (s + 1 < steps) ? fullPotential : halfPotential;
+		for (uint i = 0; i < N; i++)
+			psi[i] *= potential[i];
+	}
 }
@@ -1,22 +1,215 @@
 #pragma once
 #include <iostream>
 #include <algorithm>
+#include <vector>
+#include <complex>
+#include <functional>
+#include <cfloat>
 
 #include "../utils.h"
-//#include "Evaluator.h"
+#include "FFT.h"
+#include "Evaluator.h"
 
 typedef double (*Potential)(double);
 
+//Potential depending on a parameter: U(x, parameter)
+typedef std::function<double(double, double)> PotentialFamily;
+
+//Eigenpairs of a discretized 1D Hamiltonian, sorted by ascending energy
+struct Spectrum
+{
+	uint count = 0; //Number of eigenpairs
+	uint dimension = 0; //Points per state (interior grid points, X[0] == X[N] == 0 are implied)
+	std::vector<double> energies;
+	std::vector<double> states; //Row-major, state k starts at states[k * dimension] (empty if not requested)
+
+	double* state(uint k)
+	{
+		return &states[(size_t)k * dimension];
+	}
+
+	const double* state(uint k) const
+	{
+		return &states[(size_t)k * dimension];
+	}
+};
+
+//Lowest energies of a parameter sweep: one row of levels per parameter value
+struct SweepTable
+{
+	uint count = 0; //Number of parameter values
+	uint levels = 0; //Energies per parameter value
+	std::vector<double> parameters;
+	std::vector<double> energies; //Row-major, E_n(parameters[p]) = energies[p * levels + n]
+
+	double* row(uint p)
+	{
+		return &energies[(size_t)p * levels];
+	}
+};
+
 class Solver
 {
 public:
 	Solver() = default;
 	~Solver() = default;
 
-	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function
-	* OUTPUT: 1D Time independent Wave function at points Ni (Default Boundary Conditions)
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function;
+	*         states - also compute the (normalized) wave functions, needs O(N^2) memory
+	* OUTPUT: 1D Time independent energies and wave functions at the interior points Ni (Default Boundary Conditions)
+	*/
+	static Spectrum FDM(double S, uint N, Potential U, bool states = true);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function; k - number of states
+	* OUTPUT: The k lowest energies and normalized wave functions only (bisection + inverse iteration, O(k*N))
+	*/
+	static Spectrum FDMPartial(double S, uint N, Potential U, uint k);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function; [Emin, Emax) - energy window
+	* OUTPUT: Every energy and normalized wave function inside the window
+	*/
+	static Spectrum FDMPartial(double S, uint N, Potential U, double Emin, double Emax);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function;
+	*         previous - eigenpairs (with states) of a nearby potential on the same grid, e.g. the last slider position
+	* OUTPUT: As many eigenpairs for U, refined from previous by Rayleigh quotient iteration (a few O(N) solves each).
+	*         Falls back to a cold FDMPartial when previous does not fit the grid or a state converged to the wrong level
+	*/
+	static Spectrum FDMContinue(double S, uint N, Potential U, const Spectrum& previous);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function; k - number of states;
+	*         parallel - run the energy search of every state on its own pool thread
+	* OUTPUT: The k lowest energies and normalized wave functions at the interior points Ni, by Numerov shooting:
+	*         bisection on the node count, O(N) per energy trial and no matrix at all
+	*/
+	static Spectrum Numerov(double S, uint N, Potential U, uint k, bool parallel = false);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function; k - number of states;
+	*         tolerance - stop once the energy of a state changes less than this in one step; dtau - imaginary time step
+	* OUTPUT: The k lowest energies and normalized wave functions by imaginary time propagation (t -> -i tau),
+	*         renormalizing every step and orthogonalizing against the states already found. O(k*N) memory
+	*/
+	static Spectrum Relax(double S, uint N, Potential U, uint k = 1, double tolerance = 1e-10, double dtau = 1.0);
+
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - potential family U(x, parameter);
+	*         [first, last] - parameter range sampled at count evenly spaced values; levels - energies per value
+	* OUTPUT: E_0 ... E_levels-1 for every parameter value, the solves spread over the thread pool
+	*/
+	static SweepTable Sweep(double S, uint N, const PotentialFamily& U, double first, double last, uint count, uint levels);
+
+	//Same as above with U given as an expression in x whose variable t is the parameter
+	static SweepTable Sweep(double S, uint N, const Evaluator<double, double>& U, double first, double last, uint count, uint levels);
+
+	/* INPUT: [Sfirst, Slast] - barrier sizes sampled at count evenly spaced values; N - Number of points (>2);
+	*         U - funcpointer for a pontential function; levels - energies per barrier size
+	* OUTPUT: E_0 ... E_levels-1 for every barrier size
+	*/
+	static SweepTable SweepWidth(double Sfirst, double Slast, uint count, uint N, Potential U, uint levels);
+
+private:
+	friend class CrankNicolson;
+
+	//FDM Hamiltonian at the N - 2 interior points (tri-diagonal, O(N) memory)
+	static TridiagonalMatrix buildHamiltonian(double S, uint N, Potential U);
+
+	//Eigenpairs first ... first + count - 1 of the tridiagonal Hamiltonian
+	static Spectrum solvePartial(const TridiagonalMatrix& H, uint first, uint count);
+
+	//Samples the potential at the N - 2 interior points for one parameter value, returns the barrier size
+	typedef std::function<double(double parameter, double* potential)> Sampler;
+
+	/* Parallel core of the sweeps: every task gets its own sampler (makeSampler) and Hamiltonian
+	 * buffers, reused by all the parameter values of its chunk.
+	 */
+	static SweepTable sweep(double first, double last, uint count, uint N, uint levels, const std::function<Sampler()>& makeSampler);
+
+	//Nodes of the Numerov solution shot from the left border at energy E (= number of states below E)
+	static uint numerovNodes(const std::vector<double>& potential, double step, double E);
+
+	//Shoots from both borders at the energy E, matches at the outermost turning point and normalizes
+	static void numerovState(const std::vector<double>& potential, double step, double E, double* state);
+
+};
+
+/* Crank-Nicolson propagator for the 1D time dependent Schrodinger equation on the FDM grid:
+ * (1 + iH dt/2) psi(t + dt) = (1 - iH dt/2) psi(t), with psi fixed at 0 on both borders.
+ * The tri-diagonal left hand side is factored once (Thomas algorithm) at construction, so every
+ * step is a fused O(N) sweep with no allocation.
+ * In imaginary time the step is taken fully implicit, (1 + H dtau) psi(tau + dtau) = psi(tau): the
+ * Crank-Nicolson factor (1 - H dtau/2) / (1 + H dtau/2) tends to -1 for the stiff grid modes instead
+ * of damping them. H is shifted by its Gershgorin lower bound there, so every mode is damped by
+ * 1 / (1 + (E - shift) dtau) in (0, 1] and the ground state always decays slowest, even for E < -1/dtau.
+ */
+class CrankNicolson
+{
+public:
+	/* INPUT: S - Barrier size; N - Number of points (>2); U - funcpointer for a pontential function; dt - time step;
+	*         imaginaryTime - propagate in tau = it (psi decays towards the ground state, the norm is not kept)
 	*/
-	static Vector FDM(double S, uint N, Potential U);
+	CrankNicolson(double S, uint N, Potential U, double dt, bool imaginaryTime = false);
+	~CrankNicolson() = default;
+
+	//Advances psi (N - 2 interior points) in place by steps * dt
+	void step(Complex* psi, uint steps = 1);
 
+	//<psi|H|psi> / <psi|psi>
+	double energy(const Complex* psi) const;
+
+	uint dimension() const
+	{
+		return static_cast<uint>(diagonal.size());
+	}
+
+	double timeStep() const
+	{
+		return dt;
+	}
+
+private:
+	std::vector<double> diagonal; //Diagonal of H
+	double offdiagonal; //Off diagonal of H (constant on a uniform grid)
+	double dt;
+	Complex alpha; //Implicit weight: i dt / 2 (hbar = 1), dtau in imaginary time
+	Complex beta; //Explicit weight: i dt / 2, 0 in imaginary time
+	double shift; //Subtracted from H in the step: lower bound of the spectrum in imaginary time, 0 otherwise
+
+	std::vector<Complex> upper; //Thomas: modified super diagonal c'_i
+	std::vector<Complex> pivot; //Thomas: 1 / modified diagonal
+	std::vector<Complex> forward; //Scratch for the forward sweep
 };
 
+/* Split-operator (Strang splitting) propagator on a periodic grid of N points x_j = j S / N:
+ * psi(t + dt) = exp(-iV dt/2) F^-1 exp(-iT dt) F exp(-iV dt/2) psi(t), T = k^2 / 2.
+ * Spectrally accurate in space and unconditionally stable, O(N log N) per step. The phase tables
+ * for this (N, dt) are built once; the FFT plan is shared by every propagator of the same size.
+ */
+class SplitOperator
+{
+public:
+	/* INPUT: S - Period (box size); N - Number of points (any, powers of two are fastest); U - funcpointer for a pontential function; dt - time step
+	*/
+	SplitOperator(double S, uint N, Potential U, double dt);
+	~SplitOperator() = default;
+
+	//Advances psi (N points) in place by steps * dt
+	void step(Complex* psi, uint steps = 1);
+
+	uint dimension() const
+	{
+		return static_cast<uint>(halfPotential.size());
+	}
+
+	double timeStep() const
+	{
+		return dt;
+	}
+
+private:
+	std::shared_ptr<const FFT> fft;
+	double dt;
+
+	std::vector<Complex> halfPotential; //exp(-iV dt/2)
+	std::vector<Complex> fullPotential; //exp(-iV dt), the two half steps between consecutive steps fused
+	std::vector<Complex> kinetic; //exp(-iT dt) / N (normalization of the inverse transform folded in)
+	std::vector<Complex> scratch; //Bluestein scratch (empty for powers of two)
+};
@@ -0,0 +1,204 @@
+#include "SpectrumCache.h"
+#include <fstream>
+#include <cstring>
+
+static const char MAGIC[4] = { 'W', 'C', 'S', 'C' };
+static const uint32_t VERSION = 1;
+
+SpectrumCache::SpectrumCache(size_t capacity) : capacity(std::max<size_t>(capacity, 1)), hitCount(0)
+{
+}
+
+uint64_t SpectrumCache::hashPotential(double S, uint N, Potential U)
+{
+	const uint64_t prime = 1099511628211ull;
+	uint64_t hash = 14695981039346656037ull;
+
+	auto feed = [&](const void* data, size_t bytes)
+	{
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < bytes; i++)
+		{
+			hash ^= p[i];
+			hash *= prime;
+		}
+	};
+
+	feed(&S, sizeof(S));
+	feed(&N, sizeof(N));
+
+	//Same points Solver::buildHamiltonian samples
+	const double step = S / (N - 1);
+	for (uint i = 0; i < N - 2; i++)
+	{
+		double u = U(step * (i + 1));
+		feed(&u, sizeof(u));
+	}
+
+	return hash;
+}
+
+std::shared_ptr<const Spectrum> SpectrumCache::FDM(double S, uint N, Potential U, bool states)
+{
+	const uint64_t hash = hashPotential(S, N, U);
+
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = index.find(hash);
+		if (it != index.end())
+		{
+			const Entry& entry = *it->second;
+			if (entry.S == S && entry.N == N && (!states || !entry.spectrum->states.empty()))
+			{
+				hitCount++;
+				entries.splice(entries.begin(), entries, it->second);
+				return entry.spectrum;
+			}
+		}
+	}
+
+	//Solve outside the lock, other threads keep reading the cache meanwhile
+	Entry entry;
+	entry.hash = hash;
+	entry.S = S;
+	entry.N = N;
+	entry.spectrum = std::make_shared<const Spectrum>(Solver::FDM(S, N, U, states));
+
+	std::lock_guard<std::mutex> lock(mtx);
+	insert(entry);
+	return entry.spectrum;
+}
+
+void SpectrumCache::insert(const Entry& entry)
+{
+	auto it = index.find(entry.hash);
+	if (it != index.end())
+	{
+		entries.erase(it->second);
+		index.erase(it);
+	}
+
+	entries.push_front(entry);
+	index[entry.hash] = entries.begin();
+
+	while (entries.size() > capacity)
+	{
+		index.erase(entries.back().hash);
+		entries.pop_back();
+	}
+}
+
+void SpectrumCache::clear()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	entries.clear();
+	index.clear();
+	hitCount = 0;
+}
+
+size_t SpectrumCache::size() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return entries.size();
+}
+
+size_t SpectrumCache::hits() const
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return hitCount;
+}
+
+bool SpectrumCache::save(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		return false;
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	uint32_t count = static_cast<uint32_t>(entries.size());
+	file.write(MAGIC, sizeof(MAGIC));
+	file.write(reinterpret_cast<const char*>(&VERSION), sizeof(VERSION));
+	file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+	for (const Entry& entry : entries)
+	{
+		const Spectrum& spectrum = *entry.spectrum;
+		unsigned char hasStates = spectrum.states.empty() ? 0 : 1;
+
+		file.write(reinterpret_cast<const char*>(&entry.hash), sizeof(entry.hash));
+		file.write(reinterpret_cast<const char*>(&entry.S), sizeof(entry.S));
+		file.write(reinterpret_cast<const char*>(&entry.N), sizeof(entry.N));
+		file.write(reinterpret_cast<const char*>(&spectrum.count), sizeof(spectrum.count));
+		file.write(reinterpret_cast<const char*>(&spectrum.dimension), sizeof(spectrum.dimension));
+		file.write(reinterpret_cast<const char*>(&hasStates), sizeof(hasStates));
+		file.write(reinterpret_cast<const char*>(spectrum.energies.data()), spectrum.energies.size() * sizeof(double));
+		if (hasStates)
+			file.write(reinterpret_cast<const char*>(spectrum.states.data()), spectrum.states.size() * sizeof(double));
+	}
+
+	return file.good();
+}
+
+bool SpectrumCache::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		return false;
+
+	//Every size in the file is checked against what is left of it before anything is allocated
+	file.seekg(0, std::ios::end);
+	const std::streamoff fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	char magic[4];
+	uint32_t version = 0, count = 0;
+	file.read(magic, sizeof(magic));
+	file.read(reinterpret_cast<char*>(&version), sizeof(version));
+	file.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!file || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || version != VERSION)
+		return false;
+
+	std::vector<Entry> loaded;
+	for (uint32_t e = 0; e < count; e++)
+	{
+		Entry entry;
+		std::shared_ptr<Spectrum> spectrum = std::make_shared<Spectrum>();
+		unsigned char hasStates = 0;
+
+		file.read(reinterpret_cast<char*>(&entry.hash), sizeof(entry.hash));
+		file.read(reinterpret_cast<char*>(&entry.S), sizeof(entry.S));
+		file.read(reinterpret_cast<char*>(&entry.N), sizeof(entry.N));
+		file.read(reinterpret_cast<char*>(&spectrum->count), sizeof(spectrum->count));
+		file.read(reinterpret_cast<char*>(&spectrum->dimension), sizeof(spectrum->dimension));
+		file.read(reinterpret_cast<char*>(&hasStates), sizeof(hasStates));
+		if (!file || spectrum->dimension != entry.N - 2 || spectrum->count > spectrum->dimension || hasStates > 1)
+			return false;
+
+		const uint64_t values = static_cast<uint64_t>(fileSize - file.tellg()) / sizeof(double);
+		if (spectrum->count > values)
+			return false;
+		if (hasStates && spectrum->dimension != 0 && spectrum->count > (values - spectrum->count) / spectrum->dimension)
+			return false;
+
+		spectrum->energies.resize(spectrum->count);
+		file.read(reinterpret_cast<char*>(spectrum->energies.data()), spectrum->energies.size() * sizeof(double));
+		if (hasStates)
+		{
+			spectrum->states.resize((size_t)spectrum->count * spectrum->dimension);
+			file.read(reinterpret_cast<char*>(spectrum->states.data()), spectrum->states.size() * sizeof(double));
+		}
+		if (!file)
+			return false;
+
+		entry.spectrum = spectrum;
+		loaded.push_back(entry);
+	}
+
+	//Oldest first so the file's most recent entry ends up at the front
+	std::lock_guard<std::mutex> lock(mtx);
+	for (auto it = loaded.rbegin(); it != loaded.rend(); ++it)
+		insert(*it);
+
+	return true;
+}
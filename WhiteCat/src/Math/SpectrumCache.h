@@ -0,0 +1,61 @@
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include "Solver.h"
+
+/* Front of Solver::FDM that remembers recent spectra. An entry is keyed by a 64 bit FNV-1a hash of
+ * the potential sampled on the grid plus S and N, so two function pointers giving the same values
+ * share it. The most recently used entries are kept in memory (LRU) and can be saved to / loaded
+ * from a binary file to skip the solve on the next start.
+ */
+class SpectrumCache
+{
+public:
+	explicit SpectrumCache(size_t capacity = 16);
+	~SpectrumCache() = default;
+
+	/* INPUT: Same as Solver::FDM
+	* OUTPUT: The cached spectrum if this (U, S, N) was solved before (with states, if asked for), else a fresh solve
+	*/
+	std::shared_ptr<const Spectrum> FDM(double S, uint N, Potential U, bool states = true);
+
+	/* File layout (host byte order, raw doubles and integers): "WCSC", version, entry count, then per entry
+	 * hash, S, N, count, dimension, has states, energies[count], states[count * dimension] if any.
+	 * Entries are written most recent first. The file is a local cache, not an exchange format: one
+	 * from a host of the other byte order reads a byte swapped version and is rejected like any
+	 * foreign file. Both return false on I/O errors, a foreign file or sizes the file cannot hold.
+	 */
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+
+	void clear();
+
+	size_t size() const;
+	size_t hits() const; //Requests served without solving
+
+private:
+	struct Entry
+	{
+		uint64_t hash;
+		double S;
+		uint N;
+		std::shared_ptr<const Spectrum> spectrum;
+	};
+
+	static uint64_t hashPotential(double S, uint N, Potential U);
+
+	//Moves the entry to the front (most recent), evicting from the back past the capacity
+	void insert(const Entry& entry);
+
+	size_t capacity;
+	size_t hitCount;
+
+	std::list<Entry> entries; //Most recent first
+	std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+	mutable std::mutex mtx;
+};
@@ -0,0 +1,167 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+//Pool and index of the worker running on this thread (nullptr / -1 on outside threads)
+static thread_local const ThreadPool* tl_pool = nullptr;
+static thread_local int tl_index = -1;
+
+ThreadPool::ThreadPool(uint threads) : stop(false), queued(0)
+{
+	threads = std::max(threads, 1u);
+
+	for (uint i = 0; i <= threads; i++)
+	{
+		queues.emplace_back(new Queue());
+	}
+
+	for (uint i = 0; i < threads; i++)
+	{
+		workers.emplace_back(&ThreadPool::workerLoop, this, static_cast<int>(i));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMtx);
+		stop.store(true);
+	}
+	sleepCv.notify_all();
+
+	for (std::thread& t : workers)
+	{
+		t.join();
+	}
+}
+
+ThreadPool& ThreadPool::global()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+int ThreadPool::currentWorker() const
+{
+	return (tl_pool == this) ? tl_index : -1;
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> task)
+{
+	int self = currentWorker();
+	Queue& q = *queues[(self >= 0) ? self : workers.size()];
+
+	group.pending.fetch_add(1, std::memory_order_relaxed);
+
+	TaskGroup* g = &group;
+	{
+		std::lock_guard<std::mutex> lock(q.mtx);
+		q.tasks.emplace_back([g, task]()
+		{
+			task();
+			g->pending.fetch_sub(1, std::memory_order_release);
+		});
+	}
+
+	queued.fetch_add(1, std::memory_order_release);
+
+	//Taking the lock orders this with a worker about to sleep, so the wake up is never lost
+	{
+		std::lock_guard<std::mutex> lock(sleepMtx);
+	}
+	sleepCv.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	int self = currentWorker();
+
+	//Help instead of blocking: the awaited tasks may be sitting in our own queue
+	while (group.pending.load(std::memory_order_acquire) > 0)
+	{
+		if (!runOne(self))
+			std::this_thread::yield();
+	}
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body)
+{
+	if (end <= begin)
+		return;
+
+	const size_t count = end - begin;
+	const size_t chunks = std::max<size_t>(1, std::min<size_t>(count / std::max<size_t>(grain, 1), 4 * size()));
+	const size_t chunk = (count + chunks - 1) / chunks;
+
+	if (chunks == 1)
+	{
+		body(begin, end);
+		return;
+	}
+
+	TaskGroup group;
+	for (size_t b = begin + chunk; b < end; b += chunk)
+	{
+		size_t e = std::min(b + chunk, end);
+		submit(group, [&body, b, e]() { body(b, e); });
+	}
+
+	//The calling thread takes the first chunk itself
+	body(begin, std::min(begin + chunk, end));
+
+	wait(group);
+}
+
+bool ThreadPool::runOne(int self)
+{
+	std::function<void()> task;
+	const int n = static_cast<int>(queues.size());
+
+	//Own queue first (LIFO, keeps the recursion depth first and cache warm)
+	if (self >= 0)
+	{
+		Queue& q = *queues[self];
+		std::lock_guard<std::mutex> lock(q.mtx);
+		if (!q.tasks.empty())
+		{
+			task = std::move(q.tasks.back());
+			q.tasks.pop_back();
+		}
+	}
+
+	//Then steal the oldest (largest) task from somebody else
+	for (int i = 1; i <= n && !task; i++)
+	{
+		Queue& q = *queues[(self + i + n) % n];
+		std::lock_guard<std::mutex> lock(q.mtx);
+		if (!q.tasks.empty())
+		{
+			task = std::move(q.tasks.front());
+			q.tasks.pop_front();
+		}
+	}
+
+	if (!task)
+		return false;
+
+	queued.fetch_sub(1, std::memory_order_relaxed);
+	task();
+	return true;
+}
+
+void ThreadPool::workerLoop(int self)
+{
+	tl_pool = this;
+	tl_index = self;
+
+	while (true)
+	{
+		if (runOne(self))
+			continue;
+
+		std::unique_lock<std::mutex> lock(sleepMtx);
+		sleepCv.wait(lock, [this]() { return stop.load() || queued.load(std::memory_order_acquire) > 0; });
+
+		if (stop.load() && queued.load() == 0)
+			break;
+	}
+}
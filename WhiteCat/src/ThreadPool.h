@@ -0,0 +1,65 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+
+typedef unsigned int uint;
+
+//Counts the unfinished tasks submitted with it - ThreadPool::wait blocks on it
+struct TaskGroup
+{
+	std::atomic<int> pending{ 0 };
+};
+
+/* Work stealing pool: every worker owns a deque, pushes and pops its own tasks at the back
+ * (depth first) and steals from the front of the others when it runs dry. Threads waiting on a
+ * TaskGroup keep executing tasks, so nested fork/join (recursive solvers) never deadlocks.
+ */
+class ThreadPool
+{
+public:
+	ThreadPool(uint threads = std::thread::hardware_concurrency());
+	~ThreadPool();
+
+	//Pool shared by the solvers, sized to the machine
+	static ThreadPool& global();
+
+	void submit(TaskGroup& group, std::function<void()> task);
+	void wait(TaskGroup& group);
+
+	/* INPUT: [begin, end) - index range; grain - minimum indices per task; body - called with sub ranges
+	 * Splits the range in tasks and returns when every one of them finished.
+	 */
+	void parallelFor(size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body);
+
+	uint size() const
+	{
+		return static_cast<uint>(workers.size());
+	}
+
+	//Index of the calling worker in this pool or -1 for outside threads
+	int currentWorker() const;
+
+private:
+	struct Queue
+	{
+		std::deque<std::function<void()>> tasks;
+		std::mutex mtx;
+	};
+
+	bool runOne(int self);
+	void workerLoop(int self);
+
+	std::vector<std::unique_ptr<Queue>> queues; //One per worker plus one shared by outside threads
+	std::vector<std::thread> workers;
+
+	std::atomic<bool> stop;
+	std::atomic<int> queued;
+	std::mutex sleepMtx;
+	std::condition_variable sleepCv;
+};
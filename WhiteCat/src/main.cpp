@@ -10,11 +10,27 @@
 #include "utils.h"
 #include "Math/Evaluator.h"
 #include "Math/Solver.h"
+#include "Math/SpectrumCache.h"
 
 
 #define DEBUG
 
-void graphicsThread(std::mutex* mtx, WC_Data* data)
+//Spectra solved in earlier runs live in the user's cache folder, %LOCALAPPDATA%\WhiteCat (empty: keep them in memory only)
+std::string spectraFile()
+{
+	char base[MAX_PATH];
+	DWORD length = GetEnvironmentVariableA("LOCALAPPDATA", base, MAX_PATH);
+	if (length == 0 || length >= MAX_PATH)
+		return std::string();
+
+	std::string folder = std::string(base) + "\\WhiteCat";
+	if (!CreateDirectoryA(folder.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+		return std::string();
+
+	return folder + "\\spectra.wcsc";
+}
+
+void graphicsThread(WC_Data* data)
 {
 	GLFWwindow* window = nullptr;
 	OGLWrapper::Initialize(&window, Vector2f(1280, 720), "Window");
@@ -37,15 +53,19 @@ void graphicsThread(std::mutex* mtx, WC_Data* data)
 		std::this_thread::yield();
 	}
 
-	assert(data->pos_data != nullptr);
+	assert(data->frames.size() > 0);
 	//Data ok -> proceed
 
 	std::cout << "Data arrived and is healthy, proceeding..." << std::endl;
 
+	const GLsizei size = static_cast<GLsizei>(data->frames.size());
+
 	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vbo);
 
-	glBufferData(GL_ARRAY_BUFFER, data->size * sizeof(Point), (GLvoid*)(data->pos_data), GL_DYNAMIC_DRAW);
+	//Storage once, every new frame only replaces its contents
+	data->frames.acquire();
+	glBufferData(GL_ARRAY_BUFFER, size * sizeof(Point), (GLvoid*)(data->frames.front()), GL_DYNAMIC_DRAW);
 
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
@@ -54,29 +74,25 @@ void graphicsThread(std::mutex* mtx, WC_Data* data)
 
 	while (!glfwWindowShouldClose(window))
 	{
-		while (!Application::checkReady())
+		//Newest complete frame, if physics published one since the last draw (never waits for it)
+		if (data->frames.acquire())
 		{
-			std::cout << "Data changed. Waiting..." << std::endl;
-			std::this_thread::yield();
+			glBindBuffer(GL_ARRAY_BUFFER, vbo);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, size * sizeof(Point), (GLvoid*)(data->frames.front()));
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
 		}
 
-		mtx->lock();
-
-		glBindBuffer(GL_ARRAY_BUFFER, vbo);
-		glBufferData(GL_ARRAY_BUFFER, data->size * sizeof(Point), (GLvoid*)(data->pos_data), GL_DYNAMIC_DRAW);
-		glBindBuffer(GL_ARRAY_BUFFER, 0);
-
 		glBindVertexArray(vao);
-		glDrawArrays(GL_LINE_STRIP, 0, data->size);
+		glDrawArrays(GL_LINE_STRIP, 0, size);
 		glBindVertexArray(0);
 
-		mtx->unlock();
-
 		glfwPollEvents();
 		glfwSwapBuffers(window);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	}
 
+	data->running.store(false);
+
 	glfwDestroyWindow(window);
 	glDeleteProgram(program);
 	glDeleteVertexArrays(1, &vao);
@@ -85,29 +101,44 @@ void graphicsThread(std::mutex* mtx, WC_Data* data)
 	printf("GThread exited!\n");
 }
 
-void physicsThread(std::mutex* mtx, WC_Data* data)
+void physicsThread(WC_Data* data, SpectrumCache* spectra)
 {
-	data->pos_data = static_cast<Point*>(calloc(sizeof(Point), 3000));
-	data->size = 3000;
+	const uint N = 2000;
+
+	data->frames.allocate(N);
 
 
 	//Issue that data is ok
 	Application::setDataReady();
 
-	static float t = 0.1f;
-	static float min = -1.0f;
+	static float t = 0.0f;
+	static float min = 0.0f;
 	static float max = 1.0f;
 
 	std::chrono::time_point<std::chrono::system_clock> start = std::chrono::system_clock::now();
-	/*for (int i = 0; i < data->size; i++)
-	{
-		float x = (float)i / (data->size - 1);
-		od[i] = f(x);
-	}*/
 
 	auto pot = [](double x) -> double { return 0; }; // U(x) = 0, All x
 
-	Vector eigenvectors = Solver::FDM(1.0, 100, pot);
+	//Gaussian wave packet (x0 = 0.3, sigma = 0.05, k0 = 200) moving right in the box
+	const double dt = 1e-6;
+	const uint stepsPerFrame = 20;
+	CrankNicolson propagator(1.0, N, pot, dt);
+
+	std::vector<Complex> psi(N - 2);
+	for (uint i = 0; i < N - 2; i++)
+	{
+		double x = (double)(i + 1) / (N - 1);
+		psi[i] = std::exp(Complex(-(x - 0.3) * (x - 0.3) / (2 * 0.05 * 0.05), 200.0 * x));
+	}
+
+	//Box levels, energies only (QL, O(N^2)) and a cache hit after the first run: the packet's mean
+	//energy tells which levels it is built from
+	std::shared_ptr<const Spectrum> spectrum = spectra->FDM(1.0, N, pot, false);
+	const double meanEnergy = propagator.energy(psi.data());
+	const size_t levelsBelow = std::lower_bound(spectrum->energies.begin(), spectrum->energies.end(), meanEnergy) - spectrum->energies.begin();
+
+	std::cout << "E0: " << spectrum->energies[0] << " | Packet <E>: " << meanEnergy << " (" << levelsBelow
+		<< " levels below) | Cached spectra: " << spectra->size() << std::endl;
 
 	std::chrono::time_point<std::chrono::system_clock> end = std::chrono::system_clock::now();
 
@@ -117,19 +148,21 @@ void physicsThread(std::mutex* mtx, WC_Data* data)
 
 	std::cout << "Evaluation Time [Line " << __LINE__ << "] (ns): " << elapsed_ns << " | (us): " << elapsed_us << " | (ms): " << elapsed_ms << std::endl;
 
-	//Make this thread increment t by one every real second...
-	while (true)
+	while (data->running.load())
 	{
-		mtx->lock();
-		for (int i = 0; i < data->size; i++)
+		//Propagation and drawing run independently, physics may publish several frames per displayed one
+		propagator.step(psi.data(), stepsPerFrame);
+		t += (float)(stepsPerFrame * dt);
+
+		//Fill the slot graphics is not using, then hand it over (never blocks)
+		Point* frame = data->frames.back();
+		for (uint i = 0; i < N; i++)
 		{
-			data->pos_data[i].x = (float)i / (data->size - 1);
-			data->pos_data[i].y = *eigenvectors[i];/*0.5 * (cos(0.03 * i - 10 * t) + cos(0.036 * i - 50 * t))*/;
-			data->pos_data[i].y = (data->pos_data[i].y - min) * (2.0 / (max - min)) - 1.0;
+			frame[i].x = (float)i / (N - 1);
+			frame[i].y = (i == 0 || i == N - 1) ? 0.0f : (float)std::norm(psi[i - 1]); //|psi|^2
+			frame[i].y = (frame[i].y - min) * (2.0 / (max - min)) - 1.0;
 		}
-
-		t += 0.001f;
-		mtx->unlock();
+		data->frames.publish();
 
 		std::this_thread::sleep_for(std::chrono_literals::operator""ms((unsigned long long)10));
 		
@@ -148,7 +181,7 @@ void run()
 	Matrix m(3); //3x3 mat
 	Vector v(3); //vec 3
 
-	*v[0] = 1; *v[1] = 2; *v[3] = 0;
+	*v[0] = 1; *v[1] = 2; *v[2] = 0;
 
 	m[0][0] = 1; m[0][1] = 2; m[0][2] = 3;
 	m[1][0] = 2; m[1][1] = 1; m[1][2] = 2;
@@ -191,16 +224,24 @@ void run()
 		printf("%lf %lf %lf\n", m[i][0], m[i][1], m[i][2]);
 	}
 
+	SpectrumCache spectra;
+	const std::string cacheFile = spectraFile();
+	if (!cacheFile.empty() && spectra.load(cacheFile))
+		std::cout << "Loaded " << spectra.size() << " cached spectra" << std::endl;
+
 	Application app;
 
 	app.setup(WC_GFUNC, TO_STDFUNC(graphicsThread));
-	app.setup(WC_PFUNC, TO_STDFUNC( physicsThread));
+	app.setup(WC_PFUNC, [&spectra](WC_Data* data) { physicsThread(data, &spectra); });
 
 	app.startThread(WC_GTHREAD);
 	app.startThread(WC_PTHREAD);
 
 	app.joinThread(WC_GTHREAD);
 	app.joinThread(WC_PTHREAD);
+
+	if (!cacheFile.empty() && !spectra.save(cacheFile))
+		std::clog << "Could not write " << cacheFile << std::endl;
 }
 
 #ifdef DEBUG
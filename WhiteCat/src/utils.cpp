@@ -1,4 +1,5 @@
 #include "utils.h"
+#include "ThreadPool.h"
 #include <iostream>
 #include <vector>
 #include <fstream>
@@ -158,116 +159,366 @@ GLuint cProgram(GLuint vertexShader, GLuint fragmentShader)
 	return program;
 }
 
-//Code from https://en.wikipedia.org/wiki/LU_decomposition
-/* INPUT: A - array of pointers to rows of a square matrix having dimension N
+Arena::Arena(size_t blockSize) : current(0), offset(0), blockSize(blockSize)
+{
+}
+
+Arena::~Arena()
+{
+	for (Block& block : blocks)
+		alignedFree(reinterpret_cast<double*>(block.data));
+}
+
+Arena& Arena::local()
+{
+	thread_local Arena arena;
+	return arena;
+}
+
+void* Arena::allocateBytes(size_t bytes)
+{
+	//Whole cache lines keep every piece aligned (and 0 bytes still get a distinct address)
+	bytes = std::max<size_t>((bytes + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT, MATRIX_ALIGNMENT);
+
+	while (current < blocks.size() && offset + bytes > blocks[current].size)
+	{
+		current++;
+		offset = 0;
+	}
+
+	if (current == blocks.size())
+	{
+		Block block;
+		block.size = std::max(blockSize, bytes);
+		block.data = reinterpret_cast<char*>(alignedAlloc(block.size / sizeof(double)));
+		blocks.push_back(block);
+		offset = 0;
+	}
+
+	void* p = blocks[current].data + offset;
+	offset += bytes;
+	return p;
+}
+
+void Arena::release(Marker marker)
+{
+	//Nothing was live at the mark: the arena is empty again
+	if (marker.block == 0 && marker.offset == 0)
+	{
+		reset();
+		return;
+	}
+
+	current = marker.block;
+	offset = marker.offset;
+}
+
+void Arena::reset()
+{
+	current = 0;
+	offset = 0;
+
+	//A solve that spilled over several blocks gets one block of the total size next time
+	if (blocks.size() > 1)
+	{
+		size_t total = capacity();
+		for (Block& block : blocks)
+			alignedFree(reinterpret_cast<double*>(block.data));
+		blocks.clear();
+
+		Block block;
+		block.size = total;
+		block.data = reinterpret_cast<char*>(alignedAlloc(total / sizeof(double)));
+		blocks.push_back(block);
+	}
+}
+
+size_t Arena::capacity() const
+{
+	size_t total = 0;
+	for (const Block& block : blocks)
+		total += block.size;
+	return total;
+}
+
+//Panel width of the blocked LU and column tile of its trailing update (a LU_BLOCK x LU_TILE tile of U is 128 KB)
+static const int LU_BLOCK = 64;
+static const int LU_TILE = 256;
+
+/* C[r][c] -= sum_p L[r][p] * B[p][c] for r < rows, p < inner, c0 <= c < c1 (rows ldc, ldl, ldb doubles apart).
+ * Blocks of 4 x 4 results stay in registers for the whole p loop, so each step loads 4 values of B and
+ * 4 of L for 16 multiply-adds.
+ */
+static void LUUpdate(double* C, size_t ldc, const double* L, size_t ldl, const double* B, size_t ldb, int rows, int inner, int c0, int c1)
+{
+	int r = 0;
+	for (; r + 4 <= rows; r += 4) {
+		double* C0 = C + r * ldc; double* C1 = C0 + ldc; double* C2 = C1 + ldc; double* C3 = C2 + ldc;
+		const double* L0 = L + r * ldl; const double* L1 = L0 + ldl; const double* L2 = L1 + ldl; const double* L3 = L2 + ldl;
+
+		int c = c0;
+		for (; c + 4 <= c1; c += 4) {
+			double a00 = C0[c], a01 = C0[c + 1], a02 = C0[c + 2], a03 = C0[c + 3];
+			double a10 = C1[c], a11 = C1[c + 1], a12 = C1[c + 2], a13 = C1[c + 3];
+			double a20 = C2[c], a21 = C2[c + 1], a22 = C2[c + 2], a23 = C2[c + 3];
+			double a30 = C3[c], a31 = C3[c + 1], a32 = C3[c + 2], a33 = C3[c + 3];
+
+			const double* Bp = B + c;
+			for (int p = 0; p < inner; p++, Bp += ldb) {
+				const double b0 = Bp[0], b1 = Bp[1], b2 = Bp[2], b3 = Bp[3];
+				const double l0 = L0[p], l1 = L1[p], l2 = L2[p], l3 = L3[p];
+				a00 -= l0 * b0; a01 -= l0 * b1; a02 -= l0 * b2; a03 -= l0 * b3;
+				a10 -= l1 * b0; a11 -= l1 * b1; a12 -= l1 * b2; a13 -= l1 * b3;
+				a20 -= l2 * b0; a21 -= l2 * b1; a22 -= l2 * b2; a23 -= l2 * b3;
+				a30 -= l3 * b0; a31 -= l3 * b1; a32 -= l3 * b2; a33 -= l3 * b3;
+			}
+
+			C0[c] = a00; C0[c + 1] = a01; C0[c + 2] = a02; C0[c + 3] = a03;
+			C1[c] = a10; C1[c + 1] = a11; C1[c + 2] = a12; C1[c + 3] = a13;
+			C2[c] = a20; C2[c + 1] = a21; C2[c + 2] = a22; C2[c + 3] = a23;
+			C3[c] = a30; C3[c + 1] = a31; C3[c + 2] = a32; C3[c + 3] = a33;
+		}
+		for (; c < c1; c++) {
+			double a0 = C0[c], a1 = C1[c], a2 = C2[c], a3 = C3[c];
+			for (int p = 0; p < inner; p++) {
+				const double b = B[p * ldb + c];
+				a0 -= L0[p] * b; a1 -= L1[p] * b; a2 -= L2[p] * b; a3 -= L3[p] * b;
+			}
+			C0[c] = a0; C1[c] = a1; C2[c] = a2; C3[c] = a3;
+		}
+	}
+
+	for (; r < rows; r++) {
+		double* Cr = C + r * ldc;
+		const double* Lr = L + r * ldl;
+		for (int p = 0; p < inner; p++) {
+			const double l = Lr[p];
+			const double* Bp = B + p * ldb;
+			for (int c = c0; c < c1; c++)
+				Cr[c] -= l * Bp[c];
+		}
+	}
+}
+
+//Based on https://en.wikipedia.org/wiki/LU_decomposition, blocked right-looking variant
+/* INPUT: A - square matrix having dimension N, row-major with rows stride doubles apart
  *        Tol - small tolerance number to detect failure when the matrix is near degenerate
  * OUTPUT: Matrix A is changed, it contains both matrices L-E and U as A=(L-E)+U such that P*A=L*U.
  *        The permutation matrix is not stored as a matrix, but in an integer vector P of size N+1
  *        containing column indexes where the permutation matrix has "1". The last element P[N]=S+N,
  *        where S is the number of row exchanges needed for determinant computation, det(P)=(-1)^S
+ * Every LU_BLOCK columns: the panel is factored unblocked, the rows right of it are solved with L11
+ * and the trailing matrix gets one rank LU_BLOCK update, tiled and spread over the thread pool.
+ * Pivot rows are swapped in memory, so every loop runs over contiguous rows.
  */
-int LUPDecompose(double **A, int N, double Tol, int *P)
+int LUPDecompose(double* A, int N, size_t stride, double Tol, int* P)
 {
-	int i, j, k, imax;
-	double maxA, *ptr, absA;
-
-	for (i = 0; i <= N; i++)
+	for (int i = 0; i <= N; i++)
 		P[i] = i; //Unit permutation matrix, P[N] initialized with N
 
-	for (i = 0; i < N; i++) {
-		maxA = 0.0;
-		imax = i;
+	for (int k = 0; k < N; k += LU_BLOCK) {
+		const int kb = std::min(LU_BLOCK, N - k);
+		const int kend = k + kb;
+
+		// Panel: columns k ... kend-1, all rows below k
+
+		for (int i = k; i < kend; i++) {
+			double* Ai = A + i * stride;
+			double maxA = 0.0;
+			int imax = i;
 
-		for (k = i; k < N; k++)
-			if ((absA = fabs(A[k][i])) > maxA) {
-				maxA = absA;
-				imax = k;
+			for (int r = i; r < N; r++) {
+				double absA = fabs(A[r * stride + i]);
+				if (absA > maxA) {
+					maxA = absA;
+					imax = r;
+				}
 			}
 
-		if (maxA < Tol) return 0; //failure, matrix is degenerate
+			if (maxA < Tol) return 0; //failure, matrix is degenerate
 
-		if (imax != i) {
-			//pivoting P
-			j = P[i];
-			P[i] = P[imax];
-			P[imax] = j;
+			if (imax != i) {
+				//pivoting P
+				std::swap(P[i], P[imax]);
 
-			//pivoting rows of A
-			ptr = A[i];
-			A[i] = A[imax];
-			A[imax] = ptr;
+				//pivoting rows of A (whole rows: L to the left, the trailing matrix to the right)
+				std::swap_ranges(Ai, Ai + N, A + imax * stride);
 
-			//counting pivots starting from N (for determinant)
-			P[N]++;
+				//counting pivots starting from N (for determinant)
+				P[N]++;
+			}
+
+			const double pivot = Ai[i];
+			for (int r = i + 1; r < N; r++) {
+				double* Ar = A + r * stride;
+				double l = Ar[i] /= pivot;
+
+				for (int c = i + 1; c < kend; c++)
+					Ar[c] -= l * Ai[c];
+			}
 		}
 
-		for (j = i + 1; j < N; j++) {
-			A[j][i] /= A[i][i];
+		if (kend == N) break;
+
+		// U12 = L11^-1 * A12 (unit lower triangular, row operations)
 
-			for (k = i + 1; k < N; k++)
-				A[j][k] -= A[j][i] * A[i][k];
+		for (int i = k + 1; i < kend; i++) {
+			double* Ai = A + i * stride;
+			for (int p = k; p < i; p++) {
+				const double l = Ai[p];
+				const double* Ap = A + p * stride;
+				for (int c = kend; c < N; c++)
+					Ai[c] -= l * Ap[c];
+			}
 		}
+
+		// A22 -= L21 * U12, row blocks in parallel, column tiles keep the U12 tile in cache
+
+		ThreadPool::global().parallelFor(kend, N, 16, [&](size_t begin, size_t end)
+		{
+			const int r0 = static_cast<int>(begin);
+			const int rows = static_cast<int>(end - begin);
+
+			for (int c0 = kend; c0 < N; c0 += LU_TILE)
+				LUUpdate(A + r0 * stride, stride, A + r0 * stride + k, stride, A + k * stride, stride, rows, kb, c0, std::min(c0 + LU_TILE, N));
+		});
 	}
-	
+
 	return 1; //decomposition done 
 }
 
 /* INPUT: A,P filled in LUPDecompose; b - rhs vector; N - dimension
  * OUTPUT: x - solution vector of A*x=b
  */
-void LUPSolve(double **A, int *P, double *b, int N, double *x)
+void LUPSolve(const double* A, size_t stride, const int* P, const double* b, int N, double* x)
 {
 	for (int i = 0; i < N; i++) {
+		const double* Ai = A + i * stride;
 		x[i] = b[P[i]];
 
 		for (int k = 0; k < i; k++)
-			x[i] -= A[i][k] * x[k];
+			x[i] -= Ai[k] * x[k];
 	}
 
 	for (int i = N - 1; i >= 0; i--) {
+		const double* Ai = A + i * stride;
 		for (int k = i + 1; k < N; k++)
-			x[i] -= A[i][k] * x[k];
+			x[i] -= Ai[k] * x[k];
 
-		x[i] = x[i] / A[i][i];
+		x[i] = x[i] / Ai[i];
 	}
 }
 
-/* INPUT: A,P filled in LUPDecompose; N - dimension
- * OUTPUT: IA is the inverse of the initial matrix
+/* INPUT: A - LU from LUPDecompose; X - columns c0 ... c1-1 hold P*B (rows ldx doubles apart)
+ * OUTPUT: X - those columns overwritten by the solution of L*U*X = P*B
+ * Works on row blocks: everything coming from outside a block is one LUUpdate, only the triangle
+ * inside it is done row by row.
  */
-void LUPInvert(double **A, int *P, int N, double **IA)
+static void LUPSolveColumns(const double* A, size_t stride, int N, double* X, size_t ldx, int c0, int c1)
 {
+	// Forward with L (unit diagonal)
 
-	for (int j = 0; j < N; j++) {
-		for (int i = 0; i < N; i++) {
-			if (P[i] == j)
-				IA[i][j] = 1.0;
-			else
-				IA[i][j] = 0.0;
+	for (int i0 = 0; i0 < N; i0 += LU_BLOCK) {
+		const int i1 = std::min(i0 + LU_BLOCK, N);
+
+		LUUpdate(X + i0 * ldx, ldx, A + i0 * stride, stride, X, ldx, i1 - i0, i0, c0, c1);
 
-			for (int k = 0; k < i; k++)
-				IA[i][j] -= A[i][k] * IA[k][j];
+		for (int i = i0 + 1; i < i1; i++) {
+			const double* Ai = A + i * stride;
+			double* Xi = X + i * ldx;
+			for (int k = i0; k < i; k++) {
+				const double l = Ai[k];
+				const double* Xk = X + k * ldx;
+				for (int c = c0; c < c1; c++)
+					Xi[c] -= l * Xk[c];
+			}
 		}
+	}
+
+	// Backward with U from the bottom, row i = (row i - sum_k>i U_ik * row k) / U_ii
+
+	for (int i1 = N; i1 > 0; i1 -= LU_BLOCK) {
+		const int i0 = std::max(i1 - LU_BLOCK, 0);
+
+		LUUpdate(X + i0 * ldx, ldx, A + i0 * stride + i1, stride, X + i1 * ldx, ldx, i1 - i0, N - i1, c0, c1);
+
+		for (int i = i1 - 1; i >= i0; i--) {
+			const double* Ai = A + i * stride;
+			double* Xi = X + i * ldx;
+
+			for (int k = i + 1; k < i1; k++) {
+				const double u = Ai[k];
+				const double* Xk = X + k * ldx;
+				for (int c = c0; c < c1; c++)
+					Xi[c] -= u * Xk[c];
+			}
+
+			const double inv = 1.0 / Ai[i];
+			for (int c = c0; c < c1; c++)
+				Xi[c] *= inv;
+		}
+	}
+}
+
+/* INPUT: A,P filled in LUPDecompose; N - dimension
+ * OUTPUT: IA is the inverse of the initial matrix (rows strideIA doubles apart)
+ * Solves L*U*IA = P. Columns of IA are independent: strips of LU_BLOCK columns are solved one after
+ * the other, and groups of strips run in parallel.
+ */
+void LUPInvert(const double* A, size_t stride, const int* P, int N, double* IA, size_t strideIA)
+{
+	ThreadPool::global().parallelFor(0, N, LU_BLOCK, [&](size_t begin, size_t end)
+	{
+		for (int c0 = static_cast<int>(begin); c0 < static_cast<int>(end); c0 += LU_BLOCK) {
+			const int c1 = std::min(c0 + LU_BLOCK, static_cast<int>(end));
 
-		for (int i = N - 1; i >= 0; i--) {
-			for (int k = i + 1; k < N; k++)
-				IA[i][j] -= A[i][k] * IA[k][j];
+			for (int i = 0; i < N; i++) {
+				double* Xi = IA + i * strideIA;
+				for (int c = c0; c < c1; c++)
+					Xi[c] = (P[i] == c) ? 1.0 : 0.0;
+			}
 
-			IA[i][j] = IA[i][j] / A[i][i];
+			LUPSolveColumns(A, stride, N, IA, strideIA, c0, c1);
 		}
+	});
+}
+
+/* INPUT: A,P filled in LUPDecompose; B - nrhs right hand sides, row-major N x nrhs; N - dimension
+ * OUTPUT: X - the nrhs solutions of A*x=b, row-major N x nrhs (may be B itself)
+ * Same blocked pass as LUPInvert, the right hand sides split in parallel strips of LU_BLOCK columns.
+ */
+void LUPSolveMany(const double* A, size_t stride, const int* P, const double* B, int N, size_t nrhs, double* X)
+{
+	if (X == B) {
+		// Permuting in place would need a cycle walk per row: go through a copy
+		Arena& arena = Arena::local();
+		Arena::Scope scratch(arena);
+		double* copy = arena.allocate<double>((size_t)N * nrhs);
+		std::copy(B, B + (size_t)N * nrhs, copy);
+		LUPSolveMany(A, stride, P, copy, N, nrhs, X);
+		return;
 	}
+
+	for (int i = 0; i < N; i++)
+		memcpy(X + i * nrhs, B + P[i] * nrhs, nrhs * sizeof(double));
+
+	ThreadPool::global().parallelFor(0, nrhs, LU_BLOCK, [&](size_t begin, size_t end)
+	{
+		for (size_t c0 = begin; c0 < end; c0 += LU_BLOCK)
+			LUPSolveColumns(A, stride, N, X, nrhs, static_cast<int>(c0), static_cast<int>(std::min(c0 + LU_BLOCK, end)));
+	});
 }
 
 /* INPUT: A,P filled in LUPDecompose; N - dimension.
  * OUTPUT: Function returns the determinant of the initial matrix
  */
-double LUPDeterminant(double **A, int *P, int N)
+double LUPDeterminant(const double* A, size_t stride, const int* P, int N)
 {
 
-	double det = A[0][0];
+	double det = A[0];
 
 	for (int i = 1; i < N; i++)
-		det *= A[i][i];
+		det *= A[i * stride + i];
 
 	if ((P[N] - N) % 2 == 0)
 		return det;
@@ -275,28 +526,383 @@ double LUPDeterminant(double **A, int *P, int N)
 		return -det;
 }
 
-double* CDCCalculate(Matrix T, double b_0)
+//Subproblems at or below this size go straight to the QL solver
+static const int CDC_LEAF = 48;
+
+/* INPUT: dvals - sorted (ascending) diagonal of the k non deflated entries; z - their (normalized) rank one vector;
+ *        rho - positive rank one weight; i - root index.
+ * OUTPUT: Root i of the secular equation 1 + rho * sum(z_j^2 / (d_j - l)) = 0 as origin index + offset tau,
+ *         so lambda = dvals[origin] + tau keeps full relative accuracy for the eigenvector formula.
+ */
+static void CDCSecularRoot(const double* dvals, const double* z, int k, double rho, int i, int* origin, double* tau)
+{
+	double lo, hi;
+	int o;
+
+	if (i < k - 1) {
+		// Root lies in (d_i, d_i+1): shift to the closer pole, decided by the sign of f at the midpoint
+		double gap = dvals[i + 1] - dvals[i];
+		double mid = 0.5 * gap;
+		double f = 1.0;
+		for (int j = 0; j < k; j++) f += rho * z[j] * z[j] / ((dvals[j] - dvals[i]) - mid);
+		if (f > 0.0) { o = i; lo = 0.0; hi = mid; }
+		else { o = i + 1; lo = -mid; hi = 0.0; }
+	}
+	else {
+		// Last root lies in (d_k-1, d_k-1 + rho)
+		o = k - 1; lo = 0.0;
+		double zz = 0.0;
+		for (int j = 0; j < k; j++) zz += z[j] * z[j];
+		hi = rho * zz;
+	}
+
+	double t = 0.5 * (lo + hi);
+	for (int iter = 0; iter < 200; iter++) {
+		double f = 1.0, df = 0.0;
+		for (int j = 0; j < k; j++) {
+			double delta = (dvals[j] - dvals[o]) - t;
+			double w = z[j] / delta;
+			f += rho * z[j] * w;
+			df += rho * w * w;
+		}
+
+		// f is increasing between the poles: keep the bracket around the root
+		if (f < 0.0) lo = t; else hi = t;
+		if (f == 0.0 || hi - lo <= 2.0 * DBL_EPSILON * std::max(fabs(lo), fabs(hi)) + DBL_MIN) break;
+
+		// Newton step when it stays inside the bracket and shrinks it, bisection otherwise
+		double next = t - f / df;
+		if (!(next > lo && next < hi)) next = 0.5 * (lo + hi);
+		if (next == t) break;
+		t = next;
+	}
+
+	*origin = o;
+	*tau = t;
+}
+
+/* Merges the two solved halves: T = W (D + rho z z^T) W^T where W (rows, n*n, block diagonal) holds the
+ * eigenvectors of both halves. Deflates, solves the secular equation and writes eigenvalues to d and
+ * eigenvectors (rows) to Qt, both sorted ascending.
+ */
+static void CDCMerge(double* d, double* W, double rho, int n, double* Qt, ThreadPool& pool)
+{
+	const int m = n / 2;
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	// z = W v with v = e_(m-1) + e_m: last component of the top eigenvectors, first of the bottom ones
+
+	double* z = arena.allocate<double>(n);
+	for (int j = 0; j < n; j++) z[j] = W[(size_t)j * n + ((j < m) ? m - 1 : m)];
+
+	// Work with a positive weight: D + rho zz^T = sign * (sign*D + |rho| zz^T)
+
+	const double sign = (rho < 0.0) ? -1.0 : 1.0;
+	double znorm = 0.0;
+	for (int j = 0; j < n; j++) znorm += z[j] * z[j];
+	znorm = sqrt(znorm);
+	const double weight = fabs(rho) * znorm * znorm;
+
+	int* order = arena.allocate<int>(n);
+	double* dd = arena.allocate<double>(n);
+	for (int j = 0; j < n; j++) {
+		order[j] = j;
+		dd[j] = sign * d[j];
+		z[j] /= znorm;
+	}
+	std::sort(order, order + n, [dd](int a, int b) { return dd[a] < dd[b]; });
+
+	double dmax = 0.0;
+	for (int j = 0; j < n; j++) dmax = std::max(dmax, fabs(dd[j]));
+	const double tol = 8.0 * DBL_EPSILON * std::max(dmax, weight);
+
+	// Deflation: tiny z components, and (nearly) equal diagonal entries rotated onto a single z component
+
+	int* kept = arena.allocate<int>(n);
+	int* deflated = arena.allocate<int>(n);
+	int k = 0, deflatedCount = 0;
+
+	for (int t = 0; t < n; t++) {
+		int j = order[t];
+		if (weight * fabs(z[j]) <= tol) {
+			deflated[deflatedCount++] = j;
+			continue;
+		}
+		if (k > 0) {
+			int i = kept[k - 1];
+			if (dd[j] - dd[i] <= tol) {
+				double r = sqrt(z[i] * z[i] + z[j] * z[j]);
+				double c = z[j] / r, s = z[i] / r;
+				double* wi = W + (size_t)i * n;
+				double* wj = W + (size_t)j * n;
+				for (int col = 0; col < n; col++) {
+					double a = wi[col], b = wj[col];
+					wi[col] = c * a - s * b;
+					wj[col] = s * a + c * b;
+				}
+				z[i] = 0.0;
+				z[j] = r;
+				kept[k - 1] = j;
+				deflated[deflatedCount++] = i;
+				continue;
+			}
+		}
+		kept[k++] = j;
+	}
+
+	double* dk = arena.allocate<double>(k);
+	double* zk = arena.allocate<double>(k);
+	double* tau = arena.allocate<double>(k);
+	int* origin = arena.allocate<int>(k);
+	for (int i = 0; i < k; i++) {
+		dk[i] = dd[kept[i]];
+		zk[i] = z[kept[i]];
+	}
+
+	pool.parallelFor(0, k, 16, [&](size_t b, size_t e)
+	{
+		for (size_t i = b; i < e; i++)
+			CDCSecularRoot(dk, zk, k, weight, (int)i, &origin[i], &tau[i]);
+	});
+
+	// Gu-Eisenstat: recompute z from the computed roots so the eigenvectors come out orthogonal
+
+	double* zhat = arena.allocate<double>(k);
+	for (int j = 0; j < k; j++) {
+		double p = ((dk[origin[j]] - dk[j]) + tau[j]) / weight;
+		for (int i = 0; i < k; i++) {
+			if (i == j) continue;
+			p *= ((dk[origin[i]] - dk[j]) + tau[i]) / (dk[i] - dk[j]);
+		}
+		zhat[j] = (zk[j] >= 0.0) ? sqrt(fabs(p)) : -sqrt(fabs(p));
+	}
+
+	// Assemble: every secular eigenvector is a combination of the kept rows of W, deflated rows are copied
+
+	double* values = arena.allocate<double>(n);
+	double* rows = arena.allocate<double>((size_t)n * n);
+
+	pool.parallelFor(0, k, 4, [&](size_t b, size_t e)
+	{
+		// The chunk may run on another thread: its scratch comes from that thread's arena
+		Arena& local = Arena::local();
+		Arena::Scope chunk(local);
+		double* u = local.allocate<double>(k);
+		for (size_t i = b; i < e; i++) {
+			double norm = 0.0;
+			for (int j = 0; j < k; j++) {
+				u[j] = zhat[j] / ((dk[j] - dk[origin[i]]) - tau[i]);
+				norm += u[j] * u[j];
+			}
+			norm = sqrt(norm);
+
+			double* out = rows + i * n;
+			std::fill(out, out + n, 0.0);
+			for (int j = 0; j < k; j++) {
+				const double c = u[j] / norm;
+				const double* w = W + (size_t)kept[j] * n;
+				for (int col = 0; col < n; col++) out[col] += c * w[col];
+			}
+			values[i] = sign * (dk[origin[i]] + tau[i]);
+		}
+	});
+
+	for (int t = 0; t < deflatedCount; t++) {
+		int j = deflated[t];
+		std::copy(W + (size_t)j * n, W + (size_t)(j + 1) * n, rows + (size_t)(k + t) * n);
+		values[k + t] = d[j];
+	}
+
+	// Sort ascending into the outputs
+
+	int* idx = arena.allocate<int>(n);
+	for (int j = 0; j < n; j++) idx[j] = j;
+	std::sort(idx, idx + n, [values](int a, int b) { return values[a] < values[b]; });
+	for (int j = 0; j < n; j++) {
+		d[j] = values[idx[j]];
+		std::copy(rows + (size_t)idx[j] * n, rows + (size_t)(idx[j] + 1) * n, Qt + (size_t)j * n);
+	}
+}
+
+static void CDCSolve(double* d, double* e, int n, double* Qt, ThreadPool& pool)
+{
+	if (n <= CDC_LEAF) {
+		TQLCalculate(d, e, n, Qt);
+		return;
+	}
+
+	// Tear T into two halves plus a rank one correction rho * v v^T, v = e_(m-1) + e_m
+
+	const int m = n / 2;
+	const double rho = e[m - 1];
+	d[m - 1] -= rho;
+	d[m] -= rho;
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+	double* Q1 = arena.allocate<double>((size_t)m * m);
+	double* Q2 = arena.allocate<double>((size_t)(n - m) * (n - m));
+
+	// The halves are independent: one goes to the pool, the other runs here
+
+	TaskGroup group;
+	pool.submit(group, [&]() { CDCSolve(d, e, m, Q1, pool); });
+	CDCSolve(d + m, e + m, n - m, Q2, pool);
+	pool.wait(group);
+
+	// Block diagonal basis of both halves (rows are eigenvectors)
+
+	double* W = arena.allocate<double>((size_t)n * n);
+	std::fill(W, W + (size_t)n * n, 0.0);
+	for (int i = 0; i < m; i++)
+		std::copy(Q1 + (size_t)i * m, Q1 + (size_t)(i + 1) * m, W + (size_t)i * n);
+	for (int i = 0; i < n - m; i++)
+		std::copy(Q2 + (size_t)i * (n - m), Q2 + (size_t)(i + 1) * (n - m), W + (size_t)(m + i) * n + m);
+
+	CDCMerge(d, W, rho, n, Qt, pool);
+}
+
+/* INPUT: A - N x N symmetric matrix (contiguous, row-major, destroyed); N - dimension
+ * OUTPUT: eigenvectors - N x N, eigenvector k in column k; eigenvalues - N, same order as JEACalculate (not sorted)
+ * Parallel cyclic Jacobi: a sweep is N - 1 steps of the round-robin (Brent-Luk) tournament, each pairing
+ * every index with another one. The N/2 rotations of a step touch disjoint rows and columns, so they are
+ * applied together: rows of A (and of V^T) by pairs and columns of A row by row, both spread over the pool.
+ * The row pass is unit stride. The column pass gathers A[r][P[k]], A[r][Q[k]] within a single row, which stays
+ * in cache; transposing A every step to make it unit stride too costs more than the gather saves.
+ */
+void PJECalculate(double* A, int N, double* eigenvectors, double* eigenvalues)
 {
-	//Cuppen's Divide and conquer algorithm -  https://en.wikipedia.org/wiki/Divide-and-conquer_eigenvalue_algorithm
-	//And http://people.inf.ethz.ch/arbenz/ewp/Lnotes/chapters5-6.pdf
-	//And "New fast divide-and-conquer algorithms for the symmetric tridiagonal eigenvalue problem" by Shengguo Li, Xiangke Liao, Jie Liu, Hao Jiang
-	//Access at https://arxiv.org/abs/1510.04591
+	const int n = N;
+	if (n < 1) return;
+	if (n == 1) {
+		eigenvalues[0] = A[0];
+		eigenvectors[0] = 1.0;
+		return;
+	}
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	// V^T so that eigenvector updates are row operations too
 
-	const int N = T.dimension();
+	double* VT = arena.allocate<double>((size_t)n * n);
+	std::fill(VT, VT + (size_t)n * n, 0.0);
+	for (int i = 0; i < n; i++) VT[(size_t)i * n + i] = 1.0;
 
-	//Create a beta matrix
-	Matrix b(N);
-	int cval = static_cast<int>(std::ceil(N / 2));
-	int fval = static_cast<int>(std::floor(N / 2));
+	// Tournament positions, an odd dimension plays against a dummy index n
 
-	b[cval][cval] = -b_0;
-	b[cval][fval] = -b_0;
-	b[fval][cval] = -b_0;
-	b[fval][fval] = -b_0;
+	const int players = n + (n & 1);
+	const int pairs = players / 2;
+	int* position = arena.allocate<int>(players);
+	for (int i = 0; i < players; i++) position[i] = i;
 
-	Matrix Tcap = T - b;
+	int* P = arena.allocate<int>(pairs);
+	int* Q = arena.allocate<int>(pairs);
+	double* C = arena.allocate<double>(pairs);
+	double* S = arena.allocate<double>(pairs);
 
-	return nullptr;
+	double total = 0.0;
+	for (int i = 0; i < n * n; i++) total += A[i] * A[i];
+	const double tolerance = DBL_EPSILON * DBL_EPSILON * total;
+
+	ThreadPool& pool = ThreadPool::global();
+
+	for (int sweep = 0; sweep < 50; sweep++) {
+		double off = 0.0;
+		for (int i = 0; i < n; i++)
+			for (int j = i + 1; j < n; j++) off += A[(size_t)i * n + j] * A[(size_t)i * n + j];
+		if (off <= tolerance) break;
+
+		for (int step = 0; step < players - 1; step++) {
+			// Pairs of this step and their rotations (c, s): A_pq -> 0
+
+			int active = 0;
+			for (int i = 0; i < pairs; i++) {
+				int p = position[i], q = position[players - 1 - i];
+				if (p > q) std::swap(p, q);
+				if (q >= n) continue;
+
+				const double apq = A[(size_t)p * n + q];
+				if (apq == 0.0) continue;
+
+				const double theta = (A[(size_t)q * n + q] - A[(size_t)p * n + p]) / (2.0 * apq);
+				const double t = ((theta >= 0.0) ? 1.0 : -1.0) / (fabs(theta) + sqrt(theta * theta + 1.0));
+				const double c = 1.0 / sqrt(t * t + 1.0);
+
+				P[active] = p; Q[active] = q;
+				C[active] = c; S[active] = t * c;
+				active++;
+			}
+
+			// Next step: position 0 stays, the others rotate by one
+
+			int last = position[players - 1];
+			for (int i = players - 1; i > 1; i--) position[i] = position[i - 1];
+			position[1] = last;
+
+			if (active == 0) continue;
+
+			// A <- J^T A and V^T <- J^T V^T: each pair owns its two rows
+
+			pool.parallelFor(0, active, 8, [&](size_t begin, size_t end)
+			{
+				for (size_t k = begin; k < end; k++) {
+					const double c = C[k], s = S[k];
+					double* Ap = A + (size_t)P[k] * n; double* Aq = A + (size_t)Q[k] * n;
+					double* Vp = VT + (size_t)P[k] * n; double* Vq = VT + (size_t)Q[k] * n;
+					for (int j = 0; j < n; j++) {
+						const double ap = Ap[j], aq = Aq[j];
+						Ap[j] = c * ap - s * aq;
+						Aq[j] = s * ap + c * aq;
+					}
+					for (int j = 0; j < n; j++) {
+						const double vp = Vp[j], vq = Vq[j];
+						Vp[j] = c * vp - s * vq;
+						Vq[j] = s * vp + c * vq;
+					}
+				}
+			});
+
+			// A <- A J: every row applies all the column pairs (indexed, not unit stride)
+
+			pool.parallelFor(0, n, 32, [&](size_t begin, size_t end)
+			{
+				for (size_t r = begin; r < end; r++) {
+					double* Ar = A + r * n;
+					for (int k = 0; k < active; k++) {
+						const double ap = Ar[P[k]], aq = Ar[Q[k]];
+						Ar[P[k]] = C[k] * ap - S[k] * aq;
+						Ar[Q[k]] = S[k] * ap + C[k] * aq;
+					}
+				}
+			});
+
+			// The annihilated entries are exactly 0, not rounding noise
+
+			for (int k = 0; k < active; k++)
+				A[(size_t)P[k] * n + Q[k]] = A[(size_t)Q[k] * n + P[k]] = 0.0;
+		}
+	}
+
+	for (int k = 0; k < n; k++) eigenvalues[k] = A[(size_t)k * n + k];
+	for (int i = 0; i < n; i++)
+		for (int k = 0; k < n; k++) eigenvectors[(size_t)i * n + k] = VT[(size_t)k * n + i];
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1 (N, last entry is scratch); N - dimension.
+ * OUTPUT: d - eigenvalues in ascending order; e - destroyed; eigenvectors - N*N row-major, eigenvector k in row k.
+ * Cuppen's divide and conquer - https://en.wikipedia.org/wiki/Divide-and-conquer_eigenvalue_algorithm
+ * And http://people.inf.ethz.ch/arbenz/ewp/Lnotes/chapters5-6.pdf
+ * And "New fast divide-and-conquer algorithms for the symmetric tridiagonal eigenvalue problem" by Shengguo Li, Xiangke Liao, Jie Liu, Hao Jiang
+ * Access at https://arxiv.org/abs/1510.04591
+ * Both halves of every tear are solved as parallel tasks on the shared work stealing pool.
+ */
+void CDCCalculate(double* d, double* e, int N, double* eigenvectors)
+{
+	if (N < 1) return;
+	CDCSolve(d, e, N, eigenvectors, ThreadPool::global());
 }
 
 /* INPUT: T - Tridiagonal matrix; N - dimension.
@@ -398,4 +1004,369 @@ void JEACalculate(double* A, int N, double* eigenvectors, double* eigenvalues)
 		}
 	}
 	for (pAk = A, k = 0; k < n; pAk += n, k++) eigenvalues[k] = *(pAk + k);
-}
\ No newline at end of file
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1 (N, last entry is scratch); N - dimension.
+ * OUTPUT: d - eigenvalues in ascending order; e - destroyed;
+ *         eigenvectors - if not nullptr, N*N row-major with eigenvector k stored in row k.
+ * Implicit shift QL for symmetric tridiagonal matrices (EISPACK tql2 / Numerical Recipes tqli).
+ * O(N^2) for eigenvalues only, O(N^3) with eigenvectors but never forms the dense matrix.
+ */
+void TQLCalculate(double* d, double* e, int N, double* eigenvectors)
+{
+	int i, k, l, m, iter;
+	double b, c, f, g, p, r, s, dd;
+
+	if (N < 1) return;
+
+	if (eigenvectors != nullptr)
+	{
+		for (i = 0; i < N * N; i++) eigenvectors[i] = 0.0;
+		for (i = 0; i < N; i++) eigenvectors[i * N + i] = 1.0;
+	}
+
+	e[N - 1] = 0.0;
+
+	for (l = 0; l < N; l++) {
+		iter = 0;
+		do {
+			// Look for a negligible off diagonal element to split the matrix
+
+			for (m = l; m < N - 1; m++) {
+				dd = fabs(d[m]) + fabs(d[m + 1]);
+				if (fabs(e[m]) <= DBL_EPSILON * dd) break;
+			}
+
+			if (m != l) {
+				if (iter++ == 60) break; //No convergence, keep what we have
+
+				// Form the implicit Wilkinson shift
+
+				g = (d[l + 1] - d[l]) / (2.0 * e[l]);
+				r = hypot(g, 1.0);
+				g = d[m] - d[l] + e[l] / (g + (g >= 0.0 ? fabs(r) : -fabs(r)));
+				s = c = 1.0;
+				p = 0.0;
+
+				// Chase the bulge from m back to l with plane rotations
+
+				for (i = m - 1; i >= l; i--) {
+					f = s * e[i];
+					b = c * e[i];
+					e[i + 1] = (r = sqrt(f * f + g * g));
+					if (r == 0.0) {
+						d[i + 1] -= p;
+						e[m] = 0.0;
+						break;
+					}
+					s = f / r;
+					c = g / r;
+					g = d[i + 1] - p;
+					r = (d[i] - g) * s + 2.0 * c * b;
+					d[i + 1] = g + (p = s * r);
+					g = c * r - b;
+
+					// Rotations are accumulated on the transpose so every eigenvector ends up in a row
+					// and the update streams through two contiguous rows
+
+					if (eigenvectors != nullptr) {
+						double* zi = eigenvectors + i * N;
+						double* zi1 = zi + N;
+						for (k = 0; k < N; k++) {
+							f = zi1[k];
+							zi1[k] = s * zi[k] + c * f;
+							zi[k] = c * zi[k] - s * f;
+						}
+					}
+				}
+				if (r == 0.0 && i >= l) continue;
+				d[l] -= p;
+				e[l] = g;
+				e[m] = 0.0;
+			}
+		} while (m != l);
+	}
+
+	if (eigenvectors == nullptr)
+	{
+		std::sort(d, d + N);
+		return;
+	}
+
+	// Sort ascending, moving the eigenvector rows along with the eigenvalues
+
+	for (i = 0; i < N - 1; i++) {
+		k = i;
+		for (l = i + 1; l < N; l++)
+			if (d[l] < d[k]) k = l;
+		if (k != i) {
+			std::swap(d[i], d[k]);
+			std::swap_ranges(eigenvectors + i * N, eigenvectors + (i + 1) * N, eigenvectors + k * N);
+		}
+	}
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1; N - dimension; x - shift.
+ * OUTPUT: Number of eigenvalues strictly smaller than x (Sturm sequence of the LDL^T pivots of T - xI).
+ */
+int SturmCount(const double* d, const double* e, int N, double x)
+{
+	const double pivmin = DBL_MIN / DBL_EPSILON;
+	int count = 0;
+	double q = 1.0;
+
+	for (int i = 0; i < N; i++) {
+		q = d[i] - x - ((i > 0) ? e[i - 1] * e[i - 1] / q : 0.0);
+		if (fabs(q) < pivmin) q = -pivmin;
+		if (q < 0.0) count++;
+	}
+
+	return count;
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1; N - dimension;
+ *        first, last - indices (0 based, ascending order) of the wanted eigenvalues.
+ * OUTPUT: eigenvalues - last - first + 1 eigenvalues, computed by bisection on the Sturm count.
+ * O(N) per bisection step and independent of the eigenvalues that are not wanted.
+ */
+void TBECalculate(const double* d, const double* e, int N, int first, int last, double* eigenvalues)
+{
+	double lower = d[0], upper = d[0];
+
+	// Gershgorin bounds for the whole spectrum
+
+	for (int i = 0; i < N; i++) {
+		double radius = ((i > 0) ? fabs(e[i - 1]) : 0.0) + ((i < N - 1) ? fabs(e[i]) : 0.0);
+		lower = std::min(lower, d[i] - radius);
+		upper = std::max(upper, d[i] + radius);
+	}
+
+	const double tiny = DBL_EPSILON * std::max(fabs(lower), fabs(upper));
+
+	for (int k = first; k <= last; k++) {
+		// Eigenvalues come out in ascending order, so the previous one is a valid lower bound
+		double a = (k > first) ? eigenvalues[k - first - 1] : lower;
+		double b = upper;
+
+		while (b - a > 2.0 * DBL_EPSILON * std::max(fabs(a), fabs(b)) + tiny) {
+			double mid = 0.5 * (a + b);
+			if (SturmCount(d, e, N, mid) > k) b = mid;
+			else a = mid;
+		}
+
+		eigenvalues[k - first] = 0.5 * (a + b);
+	}
+}
+
+// LU with partial pivoting of T - shift*I (tridiagonal): U has up to two super diagonals (u1, u2) because of the swaps
+
+// (storage from the arena, valid while the caller's Scope lives)
+
+struct TridiagonalLU
+{
+	TridiagonalLU(Arena& arena, int N) : u0(arena.allocate<double>(N)), u1(arena.allocate<double>(N)),
+		u2(arena.allocate<double>(N)), l(arena.allocate<double>(N)), swapped(arena.allocate<char>(N))
+	{
+	}
+
+	double *u0, *u1, *u2, *l;
+	char* swapped;
+};
+
+static void TLUFactor(const double* d, const double* e, int N, double shift, double tiny, TridiagonalLU& f)
+{
+
+	// Rows are eliminated top to bottom, swapping with the next row when its sub diagonal is larger
+
+	double alpha = d[0] - shift;
+	double beta = (N > 1) ? e[0] : 0.0;
+	for (int i = 0; i < N - 1; i++) {
+		double sub = e[i];
+		double diag = d[i + 1] - shift;
+		double sup = (i + 1 < N - 1) ? e[i + 1] : 0.0;
+
+		if (fabs(alpha) >= fabs(sub)) {
+			if (alpha == 0.0) alpha = tiny;
+			f.l[i] = sub / alpha;
+			f.swapped[i] = 0;
+			f.u0[i] = alpha; f.u1[i] = beta; f.u2[i] = 0.0;
+			alpha = diag - f.l[i] * beta;
+			beta = sup;
+		}
+		else {
+			f.l[i] = alpha / sub;
+			f.swapped[i] = 1;
+			f.u0[i] = sub; f.u1[i] = diag; f.u2[i] = sup;
+			alpha = beta - f.l[i] * diag;
+			beta = -f.l[i] * sup;
+		}
+	}
+	f.u0[N - 1] = (fabs(alpha) < tiny) ? tiny : alpha;
+}
+
+// Solves (T - shift*I) y = x in place
+
+static void TLUSolve(const TridiagonalLU& f, int N, double* x)
+{
+	for (int i = 0; i < N - 1; i++) {
+		if (f.swapped[i]) std::swap(x[i], x[i + 1]);
+		x[i + 1] -= f.l[i] * x[i];
+	}
+	for (int i = N - 1; i >= 0; i--) {
+		double v = x[i];
+		if (i + 1 < N) v -= f.u1[i] * x[i + 1];
+		if (i + 2 < N) v -= f.u2[i] * x[i + 2];
+		x[i] = v / f.u0[i];
+	}
+}
+
+// Gram-Schmidt against count row-major vectors, then normalization. Returns the norm before normalizing
+
+static double TOrthonormalize(double* x, int N, const double* orthogonal, int count)
+{
+	for (int j = 0; j < count; j++) {
+		const double* q = orthogonal + (size_t)j * N;
+		double dot = 0.0;
+		for (int i = 0; i < N; i++) dot += q[i] * x[i];
+		for (int i = 0; i < N; i++) x[i] -= dot * q[i];
+	}
+
+	double norm = 0.0;
+	for (int i = 0; i < N; i++) norm += x[i] * x[i];
+	norm = sqrt(norm);
+	if (norm > 0.0)
+		for (int i = 0; i < N; i++) x[i] /= norm;
+
+	return norm;
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1; N - dimension.
+ * OUTPUT: max_i |d_i| + 2 |e_i|, an upper bound on the spectral radius (the scale of rounding errors).
+ */
+double TNorm(const double* d, const double* e, int N)
+{
+	double norm = 0.0;
+	for (int i = 0; i < N; i++)
+		norm = std::max(norm, fabs(d[i]) + ((i < N - 1) ? 2.0 * fabs(e[i]) : 0.0));
+	return norm;
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1; N - dimension;
+ *        eigenvalue - accurate eigenvalue (e.g. from TBECalculate);
+ *        orthogonal - orthogonalCount row-major vectors the result must be orthogonal to (close eigenvalues).
+ * OUTPUT: eigenvector - normalized eigenvector, by inverse iteration on T - eigenvalue*I.
+ * T - eigenvalue*I is factored once (LU with partial pivoting, O(N)) and reused by every iteration.
+ */
+void TIICalculate(const double* d, const double* e, int N, double eigenvalue, double* eigenvector, const double* orthogonal, int orthogonalCount)
+{
+	const double tiny = std::max(DBL_EPSILON * TNorm(d, e, N), DBL_MIN);
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	TridiagonalLU f(arena, N);
+	TLUFactor(d, e, N, eigenvalue, tiny, f);
+
+	// Start from a deterministic pseudo random vector so it is never orthogonal to the eigenvector
+
+	unsigned int seed = 12345u;
+	for (int i = 0; i < N; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		eigenvector[i] = 0.5 + (double)(seed >> 8) / (double)(1u << 24);
+	}
+
+	for (int iter = 0; iter < 5; iter++) {
+		TLUSolve(f, N, eigenvector);
+
+		// Gram-Schmidt against the already computed vectors of the same cluster
+
+		double growth = TOrthonormalize(eigenvector, N, orthogonal, orthogonalCount);
+		if (growth == 0.0) break;
+
+		// A huge growth means the shift is (numerically) an eigenvalue: one more step is enough
+		if (iter > 0 && growth > 1.0 / (1e3 * sqrt((double)N) * tiny)) break;
+	}
+}
+
+/* INPUT: d - diagonal (N); e - off diagonal, e[i] couples i and i+1; N - dimension;
+ *        eigenvector - initial guess (e.g. the eigenvector of a slightly different T);
+ *        orthogonal - orthogonalCount row-major vectors the result must be orthogonal to (close eigenvalues).
+ * OUTPUT: Returns the eigenvalue the guess converged to; eigenvector - its normalized eigenvector;
+ *         residual - if not null receives ||T x - lambda x||, which bounds the distance to the true eigenvalue.
+ * Rayleigh quotient iteration: cubic convergence, so a good guess needs 2 - 4 O(N) factorizations (the last one
+ * only polishes the vector).
+ */
+double TRQCalculate(const double* d, const double* e, int N, double* eigenvector, const double* orthogonal, int orthogonalCount, double* residual)
+{
+	const double normT = TNorm(d, e, N);
+	const double tiny = std::max(DBL_EPSILON * normT, DBL_MIN);
+	const double tolerance = 1e2 * sqrt((double)N) * DBL_EPSILON * normT;
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	TridiagonalLU f(arena, N);
+	TOrthonormalize(eigenvector, N, orthogonal, orthogonalCount);
+
+	double lambda = 0.0, r = 0.0;
+
+	// Rayleigh quotient and residual of the current vector
+
+	auto measure = [&]()
+	{
+		double quotient = 0.0;
+		for (int i = 0; i < N; i++) {
+			double Tx = d[i] * eigenvector[i] + ((i > 0) ? e[i - 1] * eigenvector[i - 1] : 0.0) + ((i < N - 1) ? e[i] * eigenvector[i + 1] : 0.0);
+			quotient += eigenvector[i] * Tx;
+		}
+		lambda = quotient;
+
+		r = 0.0;
+		for (int i = 0; i < N; i++) {
+			double Tx = d[i] * eigenvector[i] + ((i > 0) ? e[i - 1] * eigenvector[i - 1] : 0.0) + ((i < N - 1) ? e[i] * eigenvector[i + 1] : 0.0);
+			r += (Tx - lambda * eigenvector[i]) * (Tx - lambda * eigenvector[i]);
+		}
+		r = sqrt(r);
+	};
+
+	measure();
+
+	// The tolerance is on the scale of ||T|| (the kinetic term), far above the gaps between low levels:
+	// a vector that passes it still carries ~ r / gap of its neighbours. The quotient is already exact
+	// to ~ r^2 / gap though, so one more inverse iteration with it cleans the vector up to rounding
+
+	bool polish = false;
+	for (int iter = 0; iter < 10 && !polish; iter++) {
+		polish = (r <= tolerance);
+
+		TLUFactor(d, e, N, lambda, tiny, f);
+		TLUSolve(f, N, eigenvector);
+		if (TOrthonormalize(eigenvector, N, orthogonal, orthogonalCount) == 0.0) break;
+
+		measure();
+	}
+
+	if (residual != nullptr) *residual = r;
+	return lambda;
+}
+
+Vector TridiagonalMatrix::linearSolve(const TridiagonalMatrix* A, const Vector* B)
+{
+	const int N = A->dimension();
+	assert(B->dim == (size_t)N);
+
+	Vector result = *B;
+	if (N == 0)
+		return result;
+
+	const double tiny = std::max(DBL_EPSILON * TNorm(A->diagonal.data(), A->offdiagonal.data(), N), DBL_MIN);
+
+	Arena& arena = Arena::local();
+	Arena::Scope scratch(arena);
+
+	TridiagonalLU f(arena, N);
+	TLUFactor(A->diagonal.data(), A->offdiagonal.data(), N, 0.0, tiny, f);
+	TLUSolve(f, N, result.data);
+
+	return result;
+}
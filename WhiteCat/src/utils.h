@@ -7,30 +7,40 @@
 #include <stack>
 #include <string>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <atomic>
 
 #include <assert.h>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
 
 #define TO_STDFUNC(x)\
-std::function<void(std::mutex*, WC_Data*)>(x)
+std::function<void(WC_Data*)>(x)
 
 typedef unsigned int uint;
 typedef unsigned char byte;
 struct Point;
 
-//Code from https://en.wikipedia.org/wiki/LU_decomposition
-int LUPDecompose(double **A, int N, double Tol, int *P);
-void LUPSolve(double **A, int *P, double *b, int N, double *x);
-void LUPInvert(double **A, int *P, int N, double **IA);
-double LUPDeterminant(double **A, int *P, int N);
+//Code from https://en.wikipedia.org/wiki/LU_decomposition (contiguous row-major storage, rows "stride" doubles apart)
+int LUPDecompose(double* A, int N, size_t stride, double Tol, int* P);
+void LUPSolve(const double* A, size_t stride, const int* P, const double* b, int N, double* x);
+void LUPInvert(const double* A, size_t stride, const int* P, int N, double* IA, size_t strideIA);
+void LUPSolveMany(const double* A, size_t stride, const int* P, const double* B, int N, size_t nrhs, double* X);
+double LUPDeterminant(const double* A, size_t stride, const int* P, int N);
 
 void JEACalculate(double* A, int N, double* eigenvectors, double* eigenvalues);
+void PJECalculate(double* A, int N, double* eigenvectors, double* eigenvalues);
+void TQLCalculate(double* d, double* e, int N, double* eigenvectors);
+void CDCCalculate(double* d, double* e, int N, double* eigenvectors);
+int SturmCount(const double* d, const double* e, int N, double x);
+double TNorm(const double* d, const double* e, int N);
+void TBECalculate(const double* d, const double* e, int N, int first, int last, double* eigenvalues);
+void TIICalculate(const double* d, const double* e, int N, double eigenvalue, double* eigenvector, const double* orthogonal = nullptr, int orthogonalCount = 0);
+double TRQCalculate(const double* d, const double* e, int N, double* eigenvector, const double* orthogonal = nullptr, int orthogonalCount = 0, double* residual = nullptr);
 
-struct WC_Data
-{
-	size_t size;
-	Point* pos_data = nullptr;
-	byte* addata;
-};
 struct Point
 {
 	Point() : x(0.0f), y(0.0f) {  }
@@ -75,7 +85,195 @@ struct Vector2f
 	GLfloat y;
 };
 
-struct Vector
+/* Lock free hand-off of whole frames from one producer thread to one consumer thread.
+ * Of the three slots the producer owns one (back), the consumer owns one (front) and the third
+ * (middle) holds the newest finished frame. publish() swaps back and middle, acquire() swaps front
+ * and middle when a newer frame is there: both are a single atomic exchange, neither side ever waits.
+ * The producer may publish faster than the consumer reads, frames in between are simply dropped.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer() : backIndex(2), frontIndex(0), middle(1), count(0) {}
+
+	//Every slot gets size elements (before the threads start using the buffer)
+	void allocate(size_t size)
+	{
+		count = size;
+		for (std::vector<T>& slot : slots)
+			slot.assign(size, T());
+	}
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	//Producer: slot to write the next frame into
+	T* back()
+	{
+		return slots[backIndex].data();
+	}
+
+	//Producer: the back slot becomes the newest frame, the old middle one is the next back slot
+	void publish()
+	{
+		backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	//Consumer: takes the newest frame if one was published since the last call, returns whether it did
+	bool acquire()
+	{
+		if ((middle.load(std::memory_order_relaxed) & FRESH) == 0)
+			return false;
+
+		frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	//Consumer: the frame taken by the last acquire()
+	const T* front() const
+	{
+		return slots[frontIndex].data();
+	}
+
+private:
+	static const unsigned int INDEX = 3;
+	static const unsigned int FRESH = 4; //Middle holds a frame the consumer has not seen
+
+	std::vector<T> slots[3];
+	unsigned int backIndex; //Producer only
+	unsigned int frontIndex; //Consumer only
+	std::atomic<unsigned int> middle;
+	size_t count;
+};
+
+struct WC_Data
+{
+	TripleBuffer<Point> frames; //Curve points, physics -> graphics
+	std::atomic<bool> running{ true }; //Cleared by graphics when the window closes, physics stops then
+	byte* addata = nullptr;
+};
+
+struct Vector;
+struct Matrix;
+
+/* Lazy element-wise arithmetic: a + b - 2.0 * c only builds a small tree of nodes, the whole
+ * expression runs as one loop (no temporaries) when it is assigned to a Matrix / Vector.
+ * T is the leaf type (Matrix or Vector) so the two never mix. Leaves are held by reference,
+ * so an expression must be assigned within the statement that builds it (no auto).
+ */
+template<typename E, typename T>
+struct Expr
+{
+	const E& self() const
+	{
+		return static_cast<const E&>(*this);
+	}
+};
+
+//Nodes are stored by value, leaves by reference
+template<typename E>
+struct ExprOperand
+{
+	typedef const E type;
+};
+template<>
+struct ExprOperand<Matrix>
+{
+	typedef const Matrix& type;
+};
+template<>
+struct ExprOperand<Vector>
+{
+	typedef const Vector& type;
+};
+
+struct ExprAdd
+{
+	static double apply(double a, double b)
+	{
+		return a + b;
+	}
+};
+struct ExprSub
+{
+	static double apply(double a, double b)
+	{
+		return a - b;
+	}
+};
+
+template<typename L, typename R, typename Op, typename T>
+struct ExprBinary : Expr<ExprBinary<L, R, Op, T>, T>
+{
+	ExprBinary(const L& l, const R& r) : l(l), r(r)
+	{
+		assert(l.dimension() == r.dimension());
+	}
+
+	//i runs over the flat storage (padding included for a Matrix)
+	double at(size_t i) const
+	{
+		return Op::apply(l.at(i), r.at(i));
+	}
+
+	unsigned int dimension() const
+	{
+		return l.dimension();
+	}
+
+	typename ExprOperand<L>::type l;
+	typename ExprOperand<R>::type r;
+};
+
+template<typename E, typename T>
+struct ExprScale : Expr<ExprScale<E, T>, T>
+{
+	ExprScale(double s, const E& e) : s(s), e(e)
+	{
+	}
+
+	double at(size_t i) const
+	{
+		return s * e.at(i);
+	}
+
+	unsigned int dimension() const
+	{
+		return e.dimension();
+	}
+
+	double s;
+	typename ExprOperand<E>::type e;
+};
+
+template<typename L, typename R, typename T>
+ExprBinary<L, R, ExprAdd, T> operator+(const Expr<L, T>& l, const Expr<R, T>& r)
+{
+	return ExprBinary<L, R, ExprAdd, T>(l.self(), r.self());
+}
+
+template<typename L, typename R, typename T>
+ExprBinary<L, R, ExprSub, T> operator-(const Expr<L, T>& l, const Expr<R, T>& r)
+{
+	return ExprBinary<L, R, ExprSub, T>(l.self(), r.self());
+}
+
+template<typename E, typename T>
+ExprScale<E, T> operator*(double s, const Expr<E, T>& e)
+{
+	return ExprScale<E, T>(s, e.self());
+}
+
+template<typename E, typename T>
+ExprScale<E, T> operator*(const Expr<E, T>& e, double s)
+{
+	return ExprScale<E, T>(s, e.self());
+}
+
+struct Vector : Expr<Vector, Vector>
 {
 	Vector(size_t dimension)
 	{
@@ -86,12 +284,57 @@ struct Vector
 	{
 		free(data);
 	}
-	Vector(const Vector &v) : Vector(v.dim)
+	Vector(const Vector &v)
+	{
+		data = (double*)malloc(v.dim * sizeof(double));
+		dim = v.dim;
+		memcpy(data, v.data, dim * sizeof(double));
+	}
+	Vector(Vector &&v) noexcept : data(v.data), dim(v.dim)
+	{
+		v.data = nullptr;
+		v.dim = 0;
+	}
+	template<typename E>
+	Vector(const Expr<E, Vector>& e)
 	{
-		for (int i = 0; i < v.dim; i++)
+		dim = e.self().dimension();
+		data = (double*)malloc(dim * sizeof(double));
+		assign(e.self());
+	}
+
+	Vector& operator=(const Vector &v)
+	{
+		if (this != &v)
 		{
-			this->data[i] = v.data[i];
+			//Reuse the buffer when the size matches
+			if (dim != v.dim)
+			{
+				free(data);
+				data = (double*)malloc(v.dim * sizeof(double));
+				dim = v.dim;
+			}
+			memcpy(data, v.data, dim * sizeof(double));
 		}
+		return *this;
+	}
+	Vector& operator=(Vector &&v) noexcept
+	{
+		std::swap(data, v.data);
+		std::swap(dim, v.dim);
+		return *this;
+	}
+	//Element-wise, so the expression may contain this vector itself
+	template<typename E>
+	Vector& operator=(const Expr<E, Vector>& e)
+	{
+		if (dim != e.self().dimension())
+		{
+			Vector result(e);
+			return *this = std::move(result);
+		}
+		assign(e.self());
+		return *this;
 	}
 
 	double* operator[](unsigned int i)
@@ -99,6 +342,35 @@ struct Vector
 		return &data[i];
 	}
 
+	template<typename E>
+	Vector& operator+=(const Expr<E, Vector>& e)
+	{
+		const E& rhs = e.self();
+		assert(this->dim == rhs.dimension());
+		for (size_t i = 0; i < dim; i++)
+		{
+			data[i] += rhs.at(i);
+		}
+		return *this;
+	}
+
+	template<typename E>
+	Vector& operator-=(const Expr<E, Vector>& e)
+	{
+		const E& rhs = e.self();
+		assert(this->dim == rhs.dimension());
+		for (size_t i = 0; i < dim; i++)
+		{
+			data[i] -= rhs.at(i);
+		}
+		return *this;
+	}
+
+	double at(size_t i) const
+	{
+		return data[i];
+	}
+
 	unsigned int dimension() const
 	{
 		return dim;
@@ -106,65 +378,238 @@ struct Vector
 
 	double* data = nullptr;
 	size_t dim = 0;
+
+private:
+	template<typename E>
+	void assign(const E& e)
+	{
+		for (size_t i = 0; i < dim; i++)
+		{
+			data[i] = e.at(i);
+		}
+	}
 };
-//C++ is row-major order -> a_ij = a[i][j]
-struct Matrix
+
+//Every Matrix row starts on a cache line
+static const size_t MATRIX_ALIGNMENT = 64;
+
+inline double* alignedAlloc(size_t count)
 {
-	Matrix(size_t dimension)
+	size_t bytes = (count * sizeof(double) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+#ifdef _MSC_VER
+	return static_cast<double*>(_aligned_malloc(bytes, MATRIX_ALIGNMENT));
+#else
+	return static_cast<double*>(aligned_alloc(MATRIX_ALIGNMENT, bytes));
+#endif
+}
+
+inline void alignedFree(double* p)
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+/* Bump allocator for solver scratch memory. allocate() hands out MATRIX_ALIGNMENT aligned pieces of
+ * big blocks, nothing is freed one by one: a Scope gives back everything allocated during its lifetime.
+ * Blocks are kept, and merged into one when the arena becomes empty, so after the first solve of a
+ * given size the same bytes are reused and the solve loop does not touch the heap at all.
+ * Not thread safe: every thread draws from its own one, Arena::local().
+ */
+class Arena
+{
+public:
+	struct Marker
+	{
+		size_t block;
+		size_t offset;
+	};
+
+	//Releases back to the mark taken on construction (the whole arena for the outermost one)
+	class Scope
 	{
-		P = (int*)calloc(dimension, sizeof(double));
-		data = (double**)malloc(sizeof(double*) * dimension);
-		for (int i = 0; i < dimension; i++)
+	public:
+		explicit Scope(Arena& arena) : arena(arena), marker(arena.mark()) {}
+		~Scope()
 		{
-			//Set data entries to 0;
-			data[i] = (double*)calloc(dimension, sizeof(double));
+			arena.release(marker);
 		}
 
-		//LUPDecompose(data, dim, 0.001, P);
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		Arena& arena;
+		Marker marker;
+	};
+
+	explicit Arena(size_t blockSize = 1 << 20);
+	~Arena();
+
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	//Scratch owned by the calling thread
+	static Arena& local();
+
+	//Uninitialized storage for count objects, valid until the enclosing Scope ends
+	template<typename T>
+	T* allocate(size_t count)
+	{
+		return static_cast<T*>(allocateBytes(count * sizeof(T)));
+	}
 
+	void* allocateBytes(size_t bytes);
+
+	Marker mark() const
+	{
+		return { current, offset };
+	}
+
+	void release(Marker marker);
+
+	//Drops every allocation (and merges the blocks)
+	void reset();
+
+	size_t capacity() const; //Bytes held from the heap
+
+private:
+	struct Block
+	{
+		char* data;
+		size_t size;
+	};
+
+	std::vector<Block> blocks;
+	size_t current;
+	size_t offset;
+	size_t blockSize;
+};
+
+//C++ is row-major order -> a_ij = a[i][j]
+//All rows live in one aligned block, row i starts at data + i * stride (stride padded to whole cache lines)
+struct Matrix : Expr<Matrix, Matrix>
+{
+	Matrix(size_t dimension)
+	{
 		dim = dimension;
+		stride = paddedStride(dimension);
+
+		P = (int*)calloc(dimension + 1, sizeof(int));
+		data = alignedAlloc(dim * stride);
+
+		//Set data entries to 0 (padding included)
+		memset(data, 0, dim * stride * sizeof(double));
 	}
 	~Matrix()
 	{
-		free(data);
+		alignedFree(data);
+		alignedFree(lu);
 		free(P);
+		free(eigenvals);
+		free(eigenvecs);
 	}
-	Matrix(const Matrix &m) : Matrix(m.dim)
+	Matrix(const Matrix &m)
 	{
-		fillData(m.data, this->data);
+		dim = m.dim;
+		stride = m.stride;
+		P = (int*)calloc(dim + 1, sizeof(int));
+		data = alignedAlloc(dim * stride);
+		memcpy(data, m.data, dim * stride * sizeof(double));
 	}
-
-	double* operator[](unsigned int i)
+	//Steals the buffers, m is left empty (dimension 0)
+	Matrix(Matrix &&m) noexcept
 	{
-		return data[i];
+		swap(m);
+	}
+	template<typename E>
+	Matrix(const Expr<E, Matrix>& e)
+	{
+		dim = e.self().dimension();
+		stride = paddedStride(dim);
+		P = (int*)calloc(dim + 1, sizeof(int));
+		data = alignedAlloc(dim * stride);
+		assign(e.self());
 	}
 
-	Matrix operator+(Matrix& rhs)
+	Matrix& operator=(const Matrix &m)
 	{
-		assert(this->dim == rhs.dim);
-		Matrix nmat = Matrix(rhs.dim);
-		for (int i = 0; i < rhs.dim; i++)
+		if (this != &m)
 		{
-			for (int j = 0; j < rhs.dim; j++)
+			//Reuse the buffer when the size matches
+			if (dim != m.dim)
 			{
-				nmat.data[i][j] = this->data[i][j] + rhs.data[i][j];
+				Matrix copy(m);
+				swap(copy);
+				return *this;
 			}
+			memcpy(data, m.data, dim * stride * sizeof(double));
+			modified();
+		}
+		return *this;
+	}
+	Matrix& operator=(Matrix &&m) noexcept
+	{
+		swap(m);
+		return *this;
+	}
+	//Element-wise, so the expression may contain this matrix itself
+	template<typename E>
+	Matrix& operator=(const Expr<E, Matrix>& e)
+	{
+		if (dim != e.self().dimension())
+		{
+			Matrix result(e);
+			return *this = std::move(result);
+		}
+		assign(e.self());
+		modified();
+		return *this;
+	}
+
+	//Write access: the cached LU factorization is considered stale (read through a const Matrix to keep it)
+	double* operator[](unsigned int i)
+	{
+		luValid = false;
+		return data + i * stride;
+	}
+	const double* operator[](unsigned int i) const
+	{
+		return data + i * stride;
+	}
+
+	template<typename E>
+	Matrix& operator+=(const Expr<E, Matrix>& e)
+	{
+		const E& rhs = e.self();
+		assert(this->dim == rhs.dimension());
+		for (size_t i = 0; i < dim * stride; i++)
+		{
+			data[i] += rhs.at(i);
 		}
-		return nmat;
+		modified();
+		return *this;
 	}
 
-	Matrix operator-(Matrix& rhs)
+	template<typename E>
+	Matrix& operator-=(const Expr<E, Matrix>& e)
 	{
-		assert(this->dim == rhs.dim);
-		Matrix nmat = Matrix(rhs.dim);
-		for (int i = 0; i < rhs.dim; i++)
+		const E& rhs = e.self();
+		assert(this->dim == rhs.dimension());
+		for (size_t i = 0; i < dim * stride; i++)
 		{
-			for (int j = 0; j < rhs.dim; j++)
-			{
-				nmat.data[i][j] = this->data[i][j] - rhs.data[i][j];
-			}
+			data[i] -= rhs.at(i);
 		}
-		return nmat;
+		modified();
+		return *this;
+	}
+
+	//Flat index into the storage (padding included), for the expression templates
+	double at(size_t i) const
+	{
+		return data[i];
 	}
 
 	unsigned int dimension() const
@@ -172,37 +617,59 @@ struct Matrix
 		return dim;
 	}
 
+	//Doubles between the starts of two consecutive rows
+	size_t rowStride() const
+	{
+		return stride;
+	}
+
 	//Solves A*X = B -> returns X (size N vector)
 	static Vector linearSolve(Matrix* A, Vector* B)
 	{
-		double** ls_data = A->toLU();
+		A->factor();
 		Vector result = Vector(A->dim);
 		assert(A->dim == B->dim);
 
-		LUPSolve(ls_data, A->P, B->data, A->dim, result.data);
-
-		free(ls_data);
+		LUPSolve(A->lu, A->stride, A->P, B->data, A->dim, result.data);
 
 		return result;
 	}
 
-	//Calculates all Eigenvalues & Eigenvectors of A
-	static void calcEigenV(Matrix* A)
+	/* INPUT: B - nrhs right hand sides as a row-major N x nrhs block (column j is the j-th system)
+	 * OUTPUT: X - the nrhs solutions, same layout. All of them share one factorization and one blocked pass
+	 */
+	static void linearSolve(Matrix* A, const double* B, double* X, size_t nrhs)
+	{
+		A->factor();
+		LUPSolveMany(A->lu, A->stride, A->P, B, A->dim, nrhs, X);
+	}
+
+	//Calculates all Eigenvalues & Eigenvectors of A (parallel - round-robin Jacobi over the thread pool)
+	static void calcEigenV(Matrix* A, bool parallel = false)
 	{
 		const int D = A->dim;
-		double** evecs = (double**)malloc(D * sizeof(double*));
+
+		//JEACalculate works in place on a dense D x D block: pack the rows without padding
+		Arena& arena = Arena::local();
+		Arena::Scope scratch(arena);
+		double* work = arena.allocate<double>((size_t)D * D);
 		for (int i = 0; i < D; i++)
 		{
-			evecs[i] = (double*)malloc(D * sizeof(double));
+			memcpy(work + (size_t)i * D, A->data + i * A->stride, D * sizeof(double));
 		}
-		double*  evals = (double*)malloc(D * sizeof(double));
 
-		JEACalculate(*(A->data), D, *evecs, evals);
+		//Same dimension as long as the matrix lives: reuse the arrays of a previous call
+		if (A->eigenvecs == nullptr)
+			A->eigenvecs = (double*)malloc((size_t)D * D * sizeof(double));
+		if (A->eigenvals == nullptr)
+			A->eigenvals = (double*)malloc(D * sizeof(double));
 
-		assert(evecs != nullptr && evals != nullptr);
+		assert(A->eigenvecs != nullptr && A->eigenvals != nullptr);
 
-		A->eigenvals = evals;
-		A->eigenvecs = evecs;
+		if (parallel)
+			PJECalculate(work, D, A->eigenvecs, A->eigenvals);
+		else
+			JEACalculate(work, D, A->eigenvecs, A->eigenvals);
 	}
 
 	double* eigenValues() const
@@ -210,67 +677,185 @@ struct Matrix
 		return eigenvals;
 	}
 
-	double** eigenVectors() const
+	//D x D row-major, eigenvector k is column k
+	double* eigenVectors() const
 	{
 		return eigenvecs;
 	}
 
 	double determinant()
 	{
-		double** det_data = toLU();
-		double det = LUPDeterminant(det_data, P, dim);
-		free(det_data);
-		return det;
+		if (!factor())
+			return 0.0; //Degenerate (below the LU tolerance)
+		return LUPDeterminant(lu, stride, P, dim);
 	}
 
 	Matrix inverse()
 	{
+		factor();
 		Matrix inv = Matrix(dim);
-		double** inv_data = toLU();
-		LUPInvert(inv_data, P, dim, inv.data);
-		free(inv_data);
+		LUPInvert(lu, stride, P, dim, inv.data, inv.stride);
 		return inv;
 	}
 
+	void swap(Matrix& m) noexcept
+	{
+		std::swap(eigenvals, m.eigenvals);
+		std::swap(eigenvecs, m.eigenvecs);
+		std::swap(data, m.data);
+		std::swap(P, m.P);
+		std::swap(lu, m.lu);
+		std::swap(luValid, m.luValid);
+		std::swap(luRegular, m.luRegular);
+		std::swap(dim, m.dim);
+		std::swap(stride, m.stride);
+	}
+
 private:
 
-	double** allocateData()
+	static size_t paddedStride(size_t dimension)
 	{
-		double** d_data = (double**)malloc(sizeof(double*) * dim);
-		for (int i = 0; i < dim; i++)
-		{
-			//Set data entries to 0;
-			d_data[i] = (double*)calloc(dim, sizeof(double));
-		}
-		return d_data;
+		const size_t line = MATRIX_ALIGNMENT / sizeof(double);
+		return (dimension + line - 1) / line * line;
 	}
 
-	void fillData(double** src, double** dest)
+	//Every element of the padded storage, so the padding stays 0 (0 op 0)
+	template<typename E>
+	void assign(const E& e)
 	{
-		for (int i = 0; i < dim; i++)
+		for (size_t i = 0; i < dim * stride; i++)
 		{
-			for (int j = 0; j < dim; j++)
-			{
-				dest[i][j] = src[i][j];
-			}
+			data[i] = e.at(i);
 		}
 	}
 
-	//returns a copy array of a LU Matrix of the original data
-	double** toLU()
+	//The whole matrix changed: eigenpairs from calcEigenV and the LU factorization no longer match the data
+	void modified()
+	{
+		free(eigenvals);
+		free(eigenvecs);
+		eigenvals = nullptr;
+		eigenvecs = nullptr;
+		luValid = false;
+	}
+
+	//Makes lu / P the LU decomposition of the data, factoring only if it changed since the last time.
+	//Returns false if the matrix is degenerate
+	bool factor()
 	{
-		double** lu_data = allocateData();
-		fillData(data, lu_data);
-		LUPDecompose(lu_data, dim, 0.001, P);
-		return lu_data;
+		if (luValid)
+			return luRegular;
+
+		if (lu == nullptr)
+			lu = alignedAlloc(dim * stride);
+		memcpy(lu, data, dim * stride * sizeof(double));
+		luRegular = LUPDecompose(lu, dim, stride, 0.001, P) != 0;
+		luValid = true;
+
+		return luRegular;
 	}
 
 	double* eigenvals = nullptr;
-	double** eigenvecs = nullptr;
+	double* eigenvecs = nullptr;
 
-	double** data = nullptr;
+	double* data = nullptr;
 	int* P = nullptr;
+
+	double* lu = nullptr; //Cached LU decomposition (same layout as data), allocated on first use
+	bool luValid = false;
+	bool luRegular = false;
 	size_t dim = 0;
+	size_t stride = 0;
+};
+
+/* Symmetric tri-diagonal matrix, only the two bands are stored (O(N) memory):
+ * a_ii = diagonal[i], a_i,i+1 = a_i+1,i = offdiagonal[i] (the last off diagonal entry is scratch for the kernels).
+ * Every solve is O(N) and the eigen kernels work on the bands directly.
+ */
+struct TridiagonalMatrix
+{
+	TridiagonalMatrix(size_t dimension = 0) : diagonal(dimension, 0.0), offdiagonal(dimension, 0.0)
+	{
+	}
+
+	unsigned int dimension() const
+	{
+		return static_cast<unsigned int>(diagonal.size());
+	}
+
+	//y = A * x
+	void multiply(const double* x, double* y) const
+	{
+		const size_t n = diagonal.size();
+		for (size_t i = 0; i < n; i++)
+		{
+			double v = diagonal[i] * x[i];
+			if (i > 0) v += offdiagonal[i - 1] * x[i - 1];
+			if (i + 1 < n) v += offdiagonal[i] * x[i + 1];
+			y[i] = v;
+		}
+	}
+
+	Vector operator*(const Vector& x) const
+	{
+		assert(x.dim == diagonal.size());
+		Vector y(x.dim);
+		multiply(x.data, y.data);
+		return y;
+	}
+
+	//Solves A*X = B -> returns X (LU with partial pivoting, O(N))
+	static Vector linearSolve(const TridiagonalMatrix* A, const Vector* B);
+
+	//Bound on every |eigenvalue| (largest absolute row sum, counting each off diagonal twice)
+	double norm() const
+	{
+		return TNorm(diagonal.data(), offdiagonal.data(), dimension());
+	}
+
+	//Number of eigenvalues smaller than x
+	int sturmCount(double x) const
+	{
+		return SturmCount(diagonal.data(), offdiagonal.data(), dimension(), x);
+	}
+
+	//Eigenvalues first ... last (ascending, 0 based) by bisection
+	void eigenvalues(int first, int last, double* out) const
+	{
+		TBECalculate(diagonal.data(), offdiagonal.data(), dimension(), first, last, out);
+	}
+
+	//Normalized eigenvector of an accurate eigenvalue (inverse iteration), orthogonal to count row-major vectors
+	void eigenvector(double eigenvalue, double* out, const double* orthogonal = nullptr, int count = 0) const
+	{
+		TIICalculate(diagonal.data(), offdiagonal.data(), dimension(), eigenvalue, out, orthogonal, count);
+	}
+
+	//Refines an approximate eigenvector in place (Rayleigh quotient iteration), returns its eigenvalue
+	double refine(double* eigenvector, const double* orthogonal = nullptr, int count = 0, double* residual = nullptr) const
+	{
+		return TRQCalculate(diagonal.data(), offdiagonal.data(), dimension(), eigenvector, orthogonal, count, residual);
+	}
+
+	/* OUTPUT: eigenvalues - all N, ascending; eigenvectors - if not nullptr, N*N row-major, row k = eigenvector k
+	 * Divide and conquer with vectors, QL for the eigenvalues alone. The matrix itself is left untouched.
+	 */
+	void diagonalize(double* eigenvalues, double* eigenvectors = nullptr) const
+	{
+		Arena& arena = Arena::local();
+		Arena::Scope scratch(arena);
+		double* e = arena.allocate<double>(offdiagonal.size());
+		std::copy(offdiagonal.begin(), offdiagonal.end(), e);
+		std::copy(diagonal.begin(), diagonal.end(), eigenvalues);
+
+		if (eigenvectors != nullptr)
+			CDCCalculate(eigenvalues, e, dimension(), eigenvectors);
+		else
+			TQLCalculate(eigenvalues, e, dimension(), nullptr);
+	}
+
+	std::vector<double> diagonal;
+	std::vector<double> offdiagonal;
 };
 
 namespace OGLWrapper